@@ -0,0 +1,298 @@
+/*
+MIT License
+
+Copyright (c) 2021 Aubrey R Jones
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Tree depth benchmark.
+
+Parses generated `test_grammars/expr` inputs that make trees of a given shape and size, then
+times every tree operation over them, and prints one JSON object:
+
+    parse     - lexing and Lemon reductions
+    uplift    - `uplift_node()` of the internal tree to `parser::ParseNode`s
+    dotify    - `parser::dotify()` of the uplifted tree
+    equal     - `ParseNode::operator==` against a second uplift of the same tree
+    teardown  - destroying the uplifted tree
+
+The shapes are:
+
+    left   - `1 - 1 - 1 ...`, a left-deep chain of binary operators
+    right  - `- - - ... 1`, a right-deep chain of negations, which also needs a deep Lemon stack
+    wide   - `f(1, 1, 1 ...)`, one argument list with every leaf in it
+
+Each operation walks an explicit stack, so these work at any depth. For comparison, the
+benchmark also times recursive versions of uplift, dotify, and equality, like the ones the
+library used to have, but only up to `--recursive-limit` nodes deep, since past that they
+would overflow the call stack.
+
+    lempy_build --cpp out/ test_grammars/expr/expressions.lemon
+    g++ -std=c++17 -O2 -Iout -o depth bench/depth.cpp
+    ./depth [--shapes left,right,wide] [--sizes 1K,1M] [--reps N] [--recursive-limit N]
+*/
+
+#include <_parser.cpp>
+
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** Run `f` `reps` times, returning the fastest time in seconds. */
+template <typename F>
+double best_of(int reps, F && f) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < reps; i++) {
+        auto start = Clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+/** Parse a size like `1024`, `64K`, or `1M`. */
+size_t parse_size(std::string size) {
+    size_t scale = 1;
+    switch (size.empty() ? 0 : toupper(size.back())) {
+    case 'K': scale = 1 << 10; break;
+    case 'M': scale = 1 << 20; break;
+    case 'G': scale = 1 << 30; break;
+    }
+    if (scale > 1) size.pop_back();
+    return std::stoull(size) * scale;
+}
+
+/** Generate an input that makes a tree of the given shape, `n` operators or arguments long. */
+std::string generate(std::string const& shape, size_t n) {
+    std::string retval;
+    if (shape == "left") {
+        retval += "1";
+        for (size_t i = 0; i < n; i++) retval += " - 1";
+    }
+    else if (shape == "right") {
+        for (size_t i = 0; i < n; i++) retval += "- ";
+        retval += "1";
+    }
+    else if (shape == "wide") {
+        retval += "f(1";
+        for (size_t i = 0; i < n; i++) retval += ", 1";
+        retval += ")";
+    }
+    else {
+        throw std::runtime_error("Unknown shape `" + shape + "`. Choose from: left, right, wide.");
+    }
+    return retval + "\n";
+}
+
+/** Measure the depth and size of a tree, without recursing. */
+std::pair<size_t, size_t> measure(parser::ParseNode const& root) {
+    size_t depth = 0, count = 0;
+    std::vector<std::pair<parser::ParseNode const*, size_t>> stack { {&root, 1} };
+    while (!stack.empty()) {
+        auto [n, d] = stack.back();
+        stack.pop_back();
+        depth = std::max(depth, d);
+        count++;
+        for (auto const& c : *n) {
+            stack.emplace_back(&c, d + 1);
+        }
+    }
+    return {depth, count};
+}
+
+/** The recursive uplift, for comparison. */
+parser::ParseNode recursive_uplift(_parser_impl::ParseNode const* alien, int & idCounter) {
+    parser::ParseNode retval;
+    retval.id = idCounter++;
+    parser::uplift_fields(retval, alien);
+    for (auto c : alien->children) {
+        retval.children.push_back(recursive_uplift(c, idCounter));
+        if (retval.productionId >= 0) {
+            retval.span = retval.span.merge(retval.children.back().span);
+        }
+    }
+    return retval;
+}
+
+/** The recursive dotify, for comparison. */
+void recursive_dotify(parser::ParseNode const& n, std::stringstream & out, parser::ParseNode const* parent) {
+    using parser::sanitize;
+    using parser::symbol_name;
+    char buf[1024];
+    if (n.productionId >= 0) {
+        snprintf(buf, 1024, "node [shape=record, label=\"{<f0>line:%ld | <f1> %s }\"] %d;\n", n.line, sanitize(symbol_name(n.productionId)).c_str(), n.id);
+    }
+    else {
+        snprintf(buf, 1024, "node [shape=record, label=\"{<f0>line:%ld | { <f1> %s | <f2> %s}}\"] %d;\n", n.line, sanitize(symbol_name(n.typeId)).c_str(), sanitize(n.value.value()).c_str(), n.id);
+    }
+    out << buf;
+    if (parent) {
+        snprintf(buf, 1024, "%d -> %d;\n", parent->id, n.id);
+        out << buf;
+    }
+    for (auto const& c : n) {
+        recursive_dotify(c, out, &n);
+    }
+}
+
+/** The recursive equality check, for comparison. */
+bool recursive_equal(parser::ParseNode const& a, parser::ParseNode const& b) {
+    if (&a == &b) return true;
+    if (a.childCount() != b.childCount()) return false;
+    if (a.typeId != b.typeId) return false;
+    if (a.productionId != b.productionId) return false;
+    if (a.value != b.value) return false;
+    for (size_t i = 0; i < a.childCount(); i++) {
+        if (!recursive_equal(a[i], b[i])) return false;
+    }
+    return true;
+}
+
+/** Write a stage's JSON timing. */
+void print_stage(std::ostream & out, const char* name, double seconds, size_t nodes, bool first = false) {
+    out << (first ? "" : ",\n") << "     \"" << name << "\": {\"seconds\": " << seconds
+        << ", \"nodes_per_s\": " << nodes / seconds << "}";
+}
+
+/** Benchmark one shape and size, writing its JSON result. */
+void run(std::ostream & out, std::string const& shape, size_t size, int reps, size_t recursiveLimit) {
+    std::string input = generate(shape, size);
+
+    _parser_impl::Parser p;
+    _parser_impl::ParseNode* root = nullptr;
+    double parseTime = best_of(reps, [&] { root = p.parseBuffer(input); });
+
+    std::optional<parser::ParseNode> tree;
+    double upliftTime = std::numeric_limits<double>::max();
+    double teardownTime = std::numeric_limits<double>::max();
+    for (int i = 0; i < reps; i++) {
+        auto start = Clock::now();
+        tree = parser::uplift_node(root);
+        upliftTime = std::min(upliftTime, std::chrono::duration<double>(Clock::now() - start).count());
+
+        start = Clock::now();
+        tree.reset();
+        teardownTime = std::min(teardownTime, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    tree = parser::uplift_node(root);
+    parser::ParseNode other = parser::uplift_node(root);
+
+    size_t dotBytes = 0;
+    double dotifyTime = best_of(reps, [&] { dotBytes = parser::dotify(*tree).size(); });
+
+    bool equal = false;
+    double equalTime = best_of(reps, [&] { equal = *tree == other; });
+    if (!equal) {
+        throw std::runtime_error("A tree isn't equal to its own copy.");
+    }
+
+    auto [depth, nodes] = measure(*tree);
+    out << "  {\"shape\": \"" << shape << "\", \"size\": " << size
+        << ", \"depth\": " << depth << ", \"nodes\": " << nodes << ", \"dot_bytes\": " << dotBytes
+        << ",\n   \"stages\": {\n";
+    print_stage(out, "parse", parseTime, nodes, true);
+    print_stage(out, "uplift", upliftTime, nodes);
+    print_stage(out, "dotify", dotifyTime, nodes);
+    print_stage(out, "equal", equalTime, nodes);
+    print_stage(out, "teardown", teardownTime, nodes);
+
+    if (depth <= recursiveLimit) {
+        std::optional<parser::ParseNode> recursiveTree;
+        double recursiveUpliftTime = best_of(reps, [&] {
+            int idCounter = 0;
+            recursiveTree = recursive_uplift(root, idCounter);
+        });
+
+        std::string recursiveDot;
+        double recursiveDotifyTime = best_of(reps, [&] {
+            std::stringstream dot;
+            dot << "digraph \"AST\" { \n";
+            dot << "node [shape=record, style=filled];\n\n";
+            recursive_dotify(*recursiveTree, dot, nullptr);
+            dot << "\n}\n";
+            recursiveDot = dot.str();
+        });
+        if (*recursiveTree != *tree || recursiveDot != parser::dotify(*tree)) {
+            throw std::runtime_error("The recursive and iterative versions disagree.");
+        }
+
+        double recursiveEqualTime = best_of(reps, [&] { equal = recursive_equal(*tree, other); });
+
+        print_stage(out, "recursive_uplift", recursiveUpliftTime, nodes);
+        print_stage(out, "recursive_dotify", recursiveDotifyTime, nodes);
+        print_stage(out, "recursive_equal", recursiveEqualTime, nodes);
+    }
+
+    out << "\n   }}";
+}
+
+/** Split a comma-separated list. */
+std::vector<std::string> split(std::string const& list) {
+    std::vector<std::string> retval;
+    std::stringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) retval.push_back(name);
+    return retval;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> shapes { "left", "right", "wide" };
+    std::vector<std::string> sizes { "1K", "64K", "1M" };
+    int reps = 3;
+    size_t recursiveLimit = 10000;
+
+    for (int i = 1; i < argc; i += 2) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "usage: " << argv[0] << " [--shapes left,right,wide] [--sizes 1K,1M] [--reps N] [--recursive-limit N]\n";
+            return 1;
+        }
+        if (flag == "--shapes") shapes = split(argv[i + 1]);
+        else if (flag == "--sizes") sizes = split(argv[i + 1]);
+        else if (flag == "--reps") reps = std::max(1, std::stoi(argv[i + 1]));
+        else if (flag == "--recursive-limit") recursiveLimit = parse_size(argv[i + 1]);
+    }
+
+    try {
+        std::cout << "{\"reps\": " << reps << ", \"recursive_limit\": " << recursiveLimit << ", \"results\": [\n";
+        bool first = true;
+        for (auto const& shape : shapes) {
+            for (auto const& size : sizes) {
+                if (!first) std::cout << ",\n";
+                first = false;
+                run(std::cout, shape, parse_size(size), reps, recursiveLimit);
+                std::cout.flush();
+            }
+        }
+        std::cout << "\n]}\n";
+    }
+    catch (std::exception const& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
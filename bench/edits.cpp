@@ -0,0 +1,294 @@
+/*
+MIT License
+
+Copyright (c) 2021 Aubrey R Jones
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+Edit latency benchmark.
+
+Opens a `parser::Document` on a `test_grammars/expr` input, then makes random small edits to it
+and times each `edit()` against parsing the whole text from scratch. Prints one JSON object, with
+an entry per kind of edit:
+
+    replace  - change one digit to another, so nothing after it moves
+    insert   - add a digit after a digit, moving everything after it one column
+    newline  - add a line break after a comma, moving everything after it one line
+
+Every edit keeps the input valid. Each entry has the mean and worst edit times, and the mean
+counts of tokens relexed, reused in whole subtrees, and parsed one at a time.
+
+With `--verify`, nothing is timed. Instead, `--edits` random edits of each of these kinds are
+made, and the tree after each one is checked against a fresh parse of the same text: its dot
+graph, and the line and span of every node. Use a small input, since each check parses the
+whole text again.
+
+    replace  - as above
+    insert   - as above
+    delete   - remove one digit of a number with more than one
+    newline  - as above
+    comment  - put a comment line and a minus sign in front of an operand
+
+The first mismatch is printed, and the exit status is 1. So is an edit that made the text
+invalid, which is a bug in the benchmark rather than in `Document`. Otherwise, the number of edits
+checked is printed.
+
+    lempy_build --cpp out/ test_grammars/expr/expressions.lemon
+    python3 bench/generate.py expr 8M input.expr
+    g++ -std=c++17 -O2 -Iout -o edits bench/edits.cpp
+    ./edits input.expr [--edits N] [--reps N] [--seed N] [--verify]
+*/
+
+#include <_parser.cpp>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** Run `f` `reps` times, returning the fastest time in seconds. */
+template <typename F>
+double best_of(int reps, F && f) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < reps; i++) {
+        auto start = Clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+/** An edit to make: replace `[begin, end)` with `replacement`. */
+struct Edit {
+    size_t begin;
+    size_t end;
+    std::string replacement;
+};
+
+/**
+ * Pick a random edit of the given kind that keeps `text` valid, or nothing if there's no place
+ * for one at or after the random starting point.
+*/
+std::optional<Edit> pick(std::string const& text, std::string const& kind, std::mt19937 & rng) {
+    auto digit = [&] (size_t i) { return i < text.size() && isdigit(static_cast<unsigned char>(text[i])); };
+    auto wordChar = [&] (size_t i) { return isalnum(static_cast<unsigned char>(text[i])) || text[i] == '_' || text[i] == '.'; };
+    auto inComment = [&] (size_t i) {
+        size_t lineStart = text.rfind('\n', i);
+        size_t comment = text.find("//", lineStart == std::string::npos ? 0 : lineStart);
+        return comment < i;
+    };
+    auto callParen = [&] (size_t i) { // the paren of a call, which may follow its name after whitespace
+        while (i > 0 && isspace(static_cast<unsigned char>(text[i - 1]))) i--;
+        return i > 0 && wordChar(i - 1);
+    };
+    auto operand = [&] (size_t i) { // the start of an operand outside any comment or string
+        bool starts = wordChar(i) || (text[i] == '(' && !callParen(i));
+        return starts && text[i] != '.' && (i == 0 || (!wordChar(i - 1) && text[i - 1] != '"' && text[i - 1] != '\'')) && !inComment(i);
+    };
+    auto fits = [&] (size_t i) {
+        if (kind == "newline") return text[i] == ',';
+        if (kind == "delete") return digit(i) && digit(i + 1);
+        if (kind == "comment") return operand(i);
+        return digit(i);
+    };
+
+    size_t at = rng() % text.size();
+    while (at < text.size() && !fits(at)) at++;
+    if (at == text.size()) return std::nullopt;
+
+    std::string digitChar(1, static_cast<char>('1' + rng() % 9));
+    if (kind == "replace") return Edit { at, at + 1, digitChar };
+    if (kind == "delete") return Edit { at, at + 1, "" };
+    if (kind == "comment") return Edit { at, at, "//c\n-" };
+    return Edit { at + 1, at + 1, kind == "newline" ? "\n" : digitChar };
+}
+
+/** Time `edits` edits of one kind, writing its JSON result. */
+void run(std::ostream & out, parser::Document & doc, std::string const& kind, int edits, std::mt19937 & rng) {
+    double total = 0, worst = 0;
+    size_t relexed = 0, reused = 0, parsed = 0, full = 0;
+
+    for (int i = 0; i < edits; i++) {
+        auto e = pick(doc.text(), kind, rng);
+        if (!e) {
+            i--;
+            continue;
+        }
+
+        auto start = Clock::now();
+        doc.edit(e->begin, e->end, e->replacement);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        total += seconds;
+        worst = std::max(worst, seconds);
+
+        auto stats = doc.lastEditStats();
+        relexed += stats.relexedTokens;
+        reused += stats.reusedTokens;
+        parsed += stats.parsedTokens;
+        full += stats.fullParse;
+    }
+
+    out << ",\n  \"" << kind << "\": {\"mean_ms\": " << total / edits * 1000 << ", \"worst_ms\": " << worst * 1000
+        << ", \"relexed_tokens\": " << relexed / edits << ", \"reused_tokens\": " << reused / edits
+        << ", \"parsed_tokens\": " << parsed / edits << ", \"full_parses\": " << full << "}";
+}
+
+/** Describe where `a` and `b` first differ in line or span, or return nothing if they don't. */
+std::optional<std::string> differ(parser::ParseNode const& a, parser::ParseNode const& b) {
+    auto spanString = [] (parser::SourceSpan const& s) {
+        return "[" + std::to_string(s.begin) + ", " + std::to_string(s.end) + ") " + std::to_string(s.beginLine) + ":"
+            + std::to_string(s.beginColumn) + "-" + std::to_string(s.endLine) + ":" + std::to_string(s.endColumn);
+    };
+
+    std::vector<std::pair<parser::ParseNode const*, parser::ParseNode const*>> stack { { &a, &b } };
+    while (!stack.empty()) {
+        auto [x, y] = stack.back();
+        stack.pop_back();
+        if (x->line != y->line) {
+            return x->toString() + " has line " + std::to_string(x->line) + ", fresh parse has " + std::to_string(y->line);
+        }
+        if (spanString(x->span) != spanString(y->span)) {
+            return x->toString() + " has span " + spanString(x->span) + ", fresh parse has " + spanString(y->span);
+        }
+        if (x->children.size() != y->children.size()) {
+            return x->toString() + " has a different number of children than " + y->toString();
+        }
+        for (size_t i = 0; i < x->children.size(); i++) {
+            stack.emplace_back(&x->children[i], &y->children[i]);
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * Make `edits` edits of each kind, checking each result against a fresh parse. Returns false
+ * after printing the first mismatch.
+*/
+bool verify(parser::Document & doc, int edits, std::mt19937 & rng) {
+    int checked = 0;
+    for (auto kind : { "replace", "insert", "delete", "newline", "comment" }) {
+        for (int i = 0; i < edits; i++) {
+            auto e = pick(doc.text(), kind, rng);
+            if (!e) {
+                i--;
+                continue;
+            }
+
+            std::optional<parser::ParseNode> edited, fresh;
+            std::string editError, freshError;
+            try {
+                edited = doc.edit(e->begin, e->end, e->replacement).uplift();
+            }
+            catch (std::exception const& ex) {
+                editError = ex.what();
+            }
+            try {
+                fresh = parser::parse_string(doc.text());
+            }
+            catch (std::exception const& ex) {
+                freshError = ex.what();
+            }
+
+            std::optional<std::string> problem;
+            if (edited && fresh) {
+                problem = parser::dotify(*edited) != parser::dotify(*fresh) ? std::optional<std::string>("the dot graphs differ") : differ(*edited, *fresh);
+            }
+            else if (edited) {
+                problem = "edit() parsed, but a fresh parse failed: " + freshError;
+            }
+            else if (fresh) {
+                problem = "edit() failed, but a fresh parse didn't: " + editError;
+            }
+            else {
+                problem = "the edit made the text invalid, which is a bug in this benchmark: " + freshError;
+            }
+            if (problem) {
+                std::cerr << kind << " edit " << i << ", replacing [" << e->begin << ", " << e->end << ") with \""
+                          << e->replacement << "\": " << *problem << "\n";
+                return false;
+            }
+            checked++;
+        }
+    }
+    std::cout << "{\"verified_edits\": " << checked << "}\n";
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " input.expr [--edits N] [--reps N] [--seed N] [--verify]\n";
+        return 1;
+    }
+    int edits = 100;
+    int reps = 3;
+    unsigned seed = 1;
+    bool verifying = false;
+
+    for (int i = 2; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--verify") verifying = true;
+        else if (i + 1 == argc) break;
+        else if (flag == "--edits") edits = std::max(1, std::stoi(argv[++i]));
+        else if (flag == "--reps") reps = std::max(1, std::stoi(argv[++i]));
+        else if (flag == "--seed") seed = std::stoul(argv[++i]);
+    }
+
+    try {
+        std::ifstream file(argv[1], std::ios::binary);
+        if (!file) {
+            throw std::runtime_error(std::string("Cannot open ") + argv[1] + ".");
+        }
+        std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        if (verifying) {
+            parser::Document doc(input);
+            std::mt19937 rng(seed);
+            return verify(doc, edits, rng) ? 0 : 1;
+        }
+
+        _parser_impl::Parser p;
+        double parseTime = best_of(reps, [&] { p.parseBuffer(input); });
+
+        std::optional<parser::Document> doc;
+        double openTime = best_of(reps, [&] { doc.emplace(input); });
+
+        std::mt19937 rng(seed);
+        std::cout << "{\"bytes\": " << input.size() << ", \"edits\": " << edits
+                  << ",\n  \"full_parse_ms\": " << parseTime * 1000 << ", \"open_ms\": " << openTime * 1000;
+        for (auto kind : { "replace", "insert", "newline" }) {
+            run(std::cout, *doc, kind, edits, rng);
+        }
+        std::cout << "\n}\n";
+    }
+    catch (std::exception const& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
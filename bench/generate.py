@@ -0,0 +1,210 @@
+# MIT License
+
+# Copyright (c) 2021 Aubrey R Jones
+
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+'''
+Synthetic benchmark input generators for the test grammars.
+
+Each generator writes a valid input of (at least) the requested size, in bytes of UTF-8,
+using a fixed random seed so that runs are comparable. Output is written in pieces, so
+inputs much larger than memory are fine.
+
+    python3 bench/generate.py expr 16M out.expr
+'''
+
+import random
+import sys
+from typing import Callable, Dict, TextIO
+
+GROUP_SIZE = 256 # expressions per nested call, which keeps trees wide and shallow
+
+
+def parse_size(size: str) -> int:
+    '''
+    Parse a size like `1024`, `64K`, `16M`, or `1G`.
+    '''
+    units = {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}
+    size = size.strip().upper()
+    if size[-1:] in units:
+        return int(size[:-1]) * units[size[-1]]
+    return int(size)
+
+
+class _Writer:
+    '''
+    Buffers output and keeps count of the UTF-8 bytes written.
+    '''
+    def __init__(self, out: TextIO):
+        self.out = out
+        self.pieces = []
+        self.written = 0
+
+    def write(self, s: str):
+        self.pieces.append(s)
+        self.written += len(s.encode('utf-8'))
+        if len(self.pieces) >= 4096:
+            self.flush()
+
+    def flush(self):
+        self.out.write(''.join(self.pieces))
+        self.pieces = []
+
+
+def _expression_list(w: _Writer, size: int, item: Callable[[], str], call: Callable[[int], str]):
+    '''
+    Write one big expression: a call of calls, each holding up to GROUP_SIZE items.
+    '''
+    w.write(call(0))
+    group = 0
+    while w.written < size or group == 0:
+        if group:
+            w.write(',\n')
+        group += 1
+        w.write(call(group))
+        for i in range(GROUP_SIZE):
+            if i:
+                w.write(', ')
+            w.write(item())
+            if w.written >= size:
+                break
+        w.write(')')
+    w.write(')\n')
+
+
+def generate_expr(out: TextIO, size: int, seed: int = 1):
+    '''
+    Generate input for `test_grammars/expr`.
+    '''
+    r = random.Random(seed)
+    ops = ['+', '-', '*', '/']
+
+    def atom():
+        k = r.randrange(8)
+        if k == 0: return str(r.randrange(100000))
+        if k == 1: return f'{r.randrange(1000)}.{r.randrange(1000)}'
+        if k == 2: return f'"string {r.randrange(1000)} with \\"escapes\\""'
+        if k == 3: return "'c'"
+        if k == 4: return f'fn_{r.randrange(100)}(a_{r.randrange(100)}, {r.randrange(10)})'
+        if k == 5: return f'MACRO_{r.randrange(10)}(x)'
+        if k == 6: return f'-var_{r.randrange(1000)}'
+        return f'var_{r.randrange(1000)}'
+
+    def item():
+        terms = [atom() for _ in range(r.randrange(1, 6))]
+        e = terms[0]
+        for t in terms[1:]:
+            e += f' {r.choice(ops)} {t}'
+        if r.randrange(8) == 0:
+            e = f'({e}) // a comment\n'
+        return e
+
+    w = _Writer(out)
+    _expression_list(w, size, item, lambda g: f'group_{g} (' if g else 'root(')
+    w.flush()
+
+
+def generate_utf8_expr(out: TextIO, size: int, seed: int = 1):
+    '''
+    Generate input for `test_grammars/utf8_expr`.
+    '''
+    r = random.Random(seed)
+    ops = ['Добавлять', '-', '*', '/']
+
+    def atom():
+        k = r.randrange(7)
+        if k == 0: return str(r.randrange(100000))
+        if k == 1: return f'{r.randrange(1000)}.{r.randrange(1000)}'
+        if k == 2: return f'"строка {r.randrange(1000)} с \\"экранами\\""'
+        if k == 3: return "'ж'"
+        if k == 4: return f'функция_{r.randrange(100)}(аргумент_{r.randrange(100)}, {r.randrange(10)})'
+        if k == 5: return f'МАКРО_{r.randrange(10)}(Икс)'
+        return f'переменная_{r.randrange(1000)}'
+
+    def item():
+        terms = [atom() for _ in range(r.randrange(1, 6))]
+        e = terms[0]
+        for t in terms[1:]:
+            e += f' {r.choice(ops)} {t}'
+        return e
+
+    w = _Writer(out)
+    _expression_list(w, size, item, lambda g: f'группа_{g} (' if g else 'корень(')
+    w.flush()
+
+
+def generate_parasol(out: TextIO, size: int, seed: int = 1):
+    '''
+    Generate input for `test_grammars/parasol`.
+    '''
+    r = random.Random(seed)
+
+    def expr():
+        k = r.randrange(6)
+        if k == 0: return f'u[matrix_{r.randrange(50)}: mat4] * vec4(a[position_{r.randrange(50)}: vec3], 1)'
+        if k == 1: return f'normalize(light_{r.randrange(50)} - frag_{r.randrange(50)}) + {r.randrange(100)}.{r.randrange(100)}'
+        if k == 2: return f'light.color * max(0, normal *. l(light.position, pos_{r.randrange(50)}))'
+        if k == 3: return f'{{ any(c_{r.randrange(50)}) => clamp(x, 0, 1) _ => vec4(0) }}'
+        if k == 4: return '__(lights, point_light, \\accum, item => accum + item)'
+        return f'value_{r.randrange(1000)} * {r.randrange(100)} - (b && c || d)'
+
+    def pipeline_item():
+        k = r.randrange(5)
+        if k == 0: return f'v[v_{r.randrange(1000)}] = {expr()}'
+        if k == 1: return f'def f[contrib_{r.randrange(1000)}] light => {expr()}'
+        if k == 2: return f'local_{r.randrange(1000)}: vec3 = {expr()}    ; a comment'
+        if k == 3: return f'include pipeline_{r.randrange(1000)}'
+        return f'u[lights_{r.randrange(1000)}: point_light@16]'
+
+    w = _Writer(out)
+    n = 0
+    while w.written < size or n == 0:
+        n += 1
+        if r.randrange(8) == 0:
+            w.write(f'struct struct_{n} {{\n  position: vec3\n  color: vec4\n}}\n\n')
+            continue
+        w.write(f'pipeline_{n} {{\n')
+        for _ in range(r.randrange(1, 12)):
+            w.write(f'  {pipeline_item()}\n')
+        w.write('}\n\n')
+    w.flush()
+
+
+GENERATORS: Dict[str, Callable[[TextIO, int], None]] = {
+    'expr': generate_expr,
+    'utf8_expr': generate_utf8_expr,
+    'utf8_expr_native': generate_utf8_expr, # same grammar, built with `--utf8`
+    'parasol': generate_parasol,
+}
+
+
+def generate(grammar: str, size: int, path: str):
+    '''
+    Write a generated input for the named grammar to a file.
+    '''
+    with open(path, 'w', encoding='utf-8') as out:
+        GENERATORS[grammar](out, size)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 4 or sys.argv[1] not in GENERATORS:
+        print(f"usage: {sys.argv[0]} {{{','.join(GENERATORS)}}} size output_file")
+        exit(1)
+    generate(sys.argv[1], parse_size(sys.argv[2]), sys.argv[3])
@@ -0,0 +1,112 @@
+/*
+MIT License
+
+Copyright (c) 2021 Aubrey R Jones
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Multi-threaded parse throughput benchmark.
+
+Parses the same input over and over from 1, 2, 4... threads at once, and reports the
+aggregate throughput for each thread count. Every thread starts parsing at the same
+moment, so this also exercises first-use initialization of the lexer tables. The last
+tree from each thread is checked against the others after timing.
+
+Build against the C++ output of any grammar:
+
+    lempy_build --cpp out/ grammar.lemon
+    g++ -std=c++17 -O2 -pthread -Iout -o parse_threads bench/parse_threads.cpp out/_parser.cpp
+    ./parse_threads input.txt [max_threads] [parses_per_thread]
+*/
+
+#include <ParseNode.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " input_file [max_threads] [parses_per_thread]\n";
+        return 2;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    std::stringstream contents;
+    contents << in.rdbuf();
+    std::string input = contents.str();
+
+    unsigned maxThreads = argc > 2 ? std::atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    int parsesPerThread = argc > 3 ? std::atoi(argv[3]) : 20;
+
+    std::string expected;
+    for (unsigned threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+        std::atomic<unsigned> ready { 0 };
+        std::atomic<bool> go { false };
+        std::atomic<int> failures { 0 };
+        std::vector<parser::ParseNode> lastTrees(threadCount);
+
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t] {
+                ready++;
+                while (!go) std::this_thread::yield();
+
+                for (int i = 0; i < parsesPerThread; i++) {
+                    try {
+                        lastTrees[t] = parser::parse_string(input);
+                    }
+                    catch (std::exception const&) {
+                        failures++;
+                    }
+                }
+            });
+        }
+
+        while (ready < threadCount) std::this_thread::yield();
+        auto start = std::chrono::steady_clock::now();
+        go = true;
+        for (auto & t : threads) t.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        int mismatches = 0;
+        if (!failures) {
+            if (expected.empty()) expected = parser::dotify(lastTrees[0]);
+            for (auto const& tree : lastTrees) {
+                if (parser::dotify(tree) != expected) mismatches++;
+            }
+        }
+
+        double megabytes = double(input.size()) * threadCount * parsesPerThread / (1024 * 1024);
+        std::printf("threads %2u: %8.2f MB/s, %8.1f parses/s, %d failures, %d mismatches\n",
+                    threadCount, megabytes / seconds, threadCount * parsesPerThread / seconds, failures.load(), mismatches);
+
+        if (failures || mismatches) return 1;
+    }
+
+    return 0;
+}
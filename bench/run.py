@@ -0,0 +1,161 @@
+# MIT License
+
+# Copyright (c) 2021 Aubrey R Jones
+
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+'''
+Builds the test grammars with `lempy_build --cpp`, compiles `bench/stages.cpp` against
+each one, and runs it over generated inputs of each requested size. With `--python`, it
+also builds each grammar's Python module and times `parse()`, `parse_lazy()`, and `as_dict()`.
+
+Results are written as JSON, one entry per grammar and size, so runs can be diffed or
+tracked over time.
+
+    python3 bench/run.py --sizes 1K,1M,16M --out results.json
+'''
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+from generate import generate, parse_size
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(BENCH_DIR)
+GRAMMAR_DIR = os.path.join(REPO_DIR, 'test_grammars')
+
+GRAMMARS = {
+    'expr': (os.path.join(GRAMMAR_DIR, 'expr', 'expressions.lemon'), []),
+    'utf8_expr': (os.path.join(GRAMMAR_DIR, 'utf8_expr', 'expr_utf8.lemon'), ['--unicode']),
+    'utf8_expr_native': (os.path.join(GRAMMAR_DIR, 'utf8_expr', 'expr_utf8.lemon'), ['--utf8']),
+    'parasol': (os.path.join(GRAMMAR_DIR, 'parasol', 'parasol.lemon'), []),
+}
+
+PYTHON_BENCH = '''
+import json, sys, time
+sys.path.insert(0, sys.argv[1])
+mod = __import__(sys.argv[2])
+with open(sys.argv[3], 'r', encoding='utf-8') as f:
+    text = f.read()
+reps = int(sys.argv[4])
+
+def best_of(f):
+    best = None
+    for _ in range(reps):
+        start = time.perf_counter()
+        retval = f()
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best, retval
+
+parse_time, tree = best_of(lambda: mod.parse(text))
+dict_time, _ = best_of(lambda: tree.as_dict())
+lazy_time, _ = best_of(lambda: mod.parse_lazy(text))
+print(json.dumps({'parse': parse_time, 'as_dict': dict_time, 'parse_lazy': lazy_time}))
+'''
+
+
+def _env():
+    env = dict(os.environ)
+    env['PYTHONPATH'] = os.pathsep.join(filter(None, [os.path.join(REPO_DIR, 'src'), env.get('PYTHONPATH')]))
+    return env
+
+
+def _build_grammar(name: str, work_dir: str, cxx: str, python: bool):
+    '''
+    Build the C++ stage benchmark (and optionally the Python module) for a grammar.
+    '''
+    grammar, flags = GRAMMARS[name]
+    cpp_dir = os.path.join(work_dir, 'cpp')
+    subprocess.check_call([sys.executable, '-m', 'lemon_py.BuildGrammar', '--cpp', cpp_dir] + flags + [grammar], env=_env())
+    subprocess.check_call([cxx, '-std=c++17', '-O2', f'-I{cpp_dir}', '-o', os.path.join(work_dir, 'stages'), os.path.join(BENCH_DIR, 'stages.cpp')])
+
+    module = None
+    if python:
+        py_dir = os.path.join(work_dir, 'py')
+        os.makedirs(py_dir, exist_ok=True)
+        subprocess.check_call([sys.executable, '-m', 'lemon_py.BuildGrammar', '--debug', '--noinstall'] + flags + [grammar], cwd=py_dir, env=_env())
+        module = next(f[:-3] for f in os.listdir(py_dir) if f.endswith('.so'))
+    return module
+
+
+def _stage(seconds: float, input_bytes: int, tokens: int):
+    return {'seconds': seconds, 'mb_per_s': (input_bytes / 1e6) / seconds, 'tokens_per_s': tokens / seconds}
+
+
+def run(args):
+    sizes = [parse_size(s) for s in args.sizes.split(',')]
+    results = []
+
+    for name in args.grammars.split(','):
+        if name not in GRAMMARS:
+            raise ValueError(f"Unknown grammar `{name}`. Choose from: {', '.join(GRAMMARS)}.")
+
+        work_dir = os.path.join(os.path.abspath(args.work), name)
+        os.makedirs(work_dir, exist_ok=True)
+        module = _build_grammar(name, work_dir, args.cxx, args.python)
+
+        for size in sizes:
+            input_path = os.path.join(work_dir, f'input_{size}.txt')
+            if not os.path.exists(input_path):
+                generate(name, size, input_path)
+
+            command = [os.path.join(work_dir, 'stages'), input_path, '--reps', str(args.reps)]
+            if size > parse_size(args.dotify_limit):
+                command += ['--skip', 'dotify']
+            result = json.loads(subprocess.check_output(command))
+            result['grammar'] = name
+            result['size'] = size
+
+            if module and size <= parse_size(args.python_limit):
+                timings = json.loads(subprocess.check_output(
+                    [sys.executable, '-c', PYTHON_BENCH, os.path.join(work_dir, 'py'), module, input_path, str(args.reps)]))
+                result['stages']['py_parse'] = _stage(timings['parse'], result['input_bytes'], result['tokens'])
+                result['stages']['as_dict'] = _stage(timings['as_dict'], result['input_bytes'], result['tokens'])
+                result['stages']['py_parse_lazy'] = _stage(timings['parse_lazy'], result['input_bytes'], result['tokens'])
+
+            results.append(result)
+            summary = ', '.join(f"{stage} {t['mb_per_s']:.1f} MB/s" for stage, t in result['stages'].items())
+            print(f"{name} {size}: {summary}", file=sys.stderr)
+
+    return {'results': results}
+
+
+if __name__ == '__main__':
+    ap = argparse.ArgumentParser(description="Run the lexer/parser/uplift throughput benchmarks.")
+    ap.add_argument('--grammars', type=str, default=','.join(GRAMMARS), help="Comma-separated grammars to benchmark.")
+    ap.add_argument('--sizes', type=str, default='1K,64K,1M,16M', help="Comma-separated input sizes, like `1K,1M,1G`.")
+    ap.add_argument('--reps', type=int, default=3, help="Repetitions per stage. The fastest is reported.")
+    ap.add_argument('--dotify-limit', type=str, default='64M', help="Skip `dotify` for inputs larger than this.")
+    ap.add_argument('--python', default=False, const=True, action='store_const', help="Also build the Python modules and time `parse()` and `as_dict()`.")
+    ap.add_argument('--python-limit', type=str, default='64M', help="Skip the Python stages for inputs larger than this.")
+    ap.add_argument('--cxx', type=str, default=os.environ.get('CXX', 'g++'), help="C++ compiler to build the benchmark with.")
+    ap.add_argument('--work', type=str, default='bench_work', help="Directory for builds and generated inputs, which are reused between runs.")
+    ap.add_argument('--out', type=str, required=False, help="Write JSON results here instead of stdout.")
+    args = ap.parse_args()
+
+    results = run(args)
+    if args.out:
+        with open(args.out, 'w') as f:
+            json.dump(results, f, indent=1)
+    else:
+        json.dump(results, sys.stdout, indent=1)
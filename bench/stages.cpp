@@ -0,0 +1,201 @@
+/*
+MIT License
+
+Copyright (c) 2021 Aubrey R Jones
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+Per-stage parser throughput benchmark.
+
+Times each stage of a parse separately and prints one JSON object:
+
+    decode  - converting (`--unicode`) or validating (`--utf8`) UTF-8 input, if either is enabled
+    lex     - `Lexer::next()` over the whole input
+    parse   - `LemonPyParse()` reductions (lex + parse time, less the lex time)
+    uplift  - `uplift_node()` of the internal tree to `parser::ParseNode`s
+    dotify  - `parser::dotify()` of the uplifted tree
+
+Each stage reports MB/s and tokens/s relative to the input. This is compiled as a single
+translation unit with the generated parser, so it can reach the lexer directly:
+
+    lempy_build --cpp out/ grammar.lemon
+    g++ -std=c++17 -O2 -Iout -o stages bench/stages.cpp
+    ./stages input.txt [--reps N] [--skip dotify,uplift]
+
+`bench/run.py` does all of that for the test grammars, over generated inputs.
+*/
+
+#include <_parser.cpp>
+
+#include <chrono>
+#include <iostream>
+#include <set>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** Run `f` `reps` times, returning the fastest time in seconds. */
+template <typename F>
+double best_of(int reps, F && f) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < reps; i++) {
+        auto start = Clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+/** Count the nodes in a tree, without recursing. */
+size_t count_nodes(parser::ParseNode const& root) {
+    size_t count = 0;
+    std::vector<parser::ParseNode const*> stack { &root };
+    while (!stack.empty()) {
+        auto n = stack.back();
+        stack.pop_back();
+        count++;
+        for (auto const& c : *n) {
+            stack.push_back(&c);
+        }
+    }
+    return count;
+}
+
+/** Quote a string for JSON. */
+std::string json_string(std::string const& s) {
+    std::string retval = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') retval += '\\';
+        retval += c;
+    }
+    return retval + "\"";
+}
+
+/** Write a stage's JSON timings. */
+void print_stage(std::ostream & out, const char* name, double seconds, size_t bytes, size_t tokens) {
+    out << "    \"" << name << "\": {\"seconds\": " << seconds
+        << ", \"mb_per_s\": " << (bytes / 1e6) / seconds
+        << ", \"tokens_per_s\": " << tokens / seconds << "}";
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " input.txt [--reps N] [--skip stage,stage]\n";
+        return 1;
+    }
+
+    int reps = 3;
+    std::set<std::string> skip;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--reps") {
+            reps = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (flag == "--skip") {
+            std::stringstream names(argv[i + 1]);
+            std::string name;
+            while (std::getline(names, name, ',')) skip.insert(name);
+        }
+    }
+
+    using namespace _parser_impl;
+
+    InputFile file(argv[1]);
+    std::string_view external = file.view();
+#ifdef LEMON_PY_UNICODE_SUPPORT
+    ustring internal;
+    double decodeTime = best_of(reps, [&] {
+        internal.clear();
+        utf8::utf8to32(external.begin(), external.end(), std::back_inserter(internal));
+    });
+    ustring_view input = internal;
+#elif defined(LEMON_PY_UTF8_SUPPORT)
+    double decodeTime = best_of(reps, [&] { checkUtf8(external); }); // `--utf8` only validates
+    ustring_view input = external;
+#else
+    ustring_view input = external;
+#endif
+
+    size_t tokens = 0;
+    StringTable stringTable;
+    double lexTime = best_of(reps, [&] {
+        stringTable.clear();
+        Lexer lexer(input, stringTable);
+        tokens = 0;
+        while (lexer.next()) tokens++;
+    });
+
+    Parser p;
+    ParseNode* root = nullptr;
+    double lexParseTime = best_of(reps, [&] { root = p.parseView(input); });
+
+    std::optional<parser::ParseNode> tree;
+    double upliftTime = 0;
+    if (!skip.count("uplift") || !skip.count("dotify")) {
+        upliftTime = std::numeric_limits<double>::max();
+        for (int i = 0; i < reps; i++) {
+            tree.reset(); // don't time tearing down the last tree
+            auto start = Clock::now();
+            tree = parser::uplift_node(root);
+            upliftTime = std::min(upliftTime, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+    }
+
+    double dotifyTime = 0;
+    size_t dotBytes = 0;
+    if (!skip.count("dotify")) {
+        dotifyTime = best_of(reps, [&] { dotBytes = parser::dotify(*tree).size(); });
+    }
+
+    size_t bytes = external.size();
+    std::cout << "{\n  \"input\": " << json_string(argv[1]) << ",\n"
+              << "  \"input_bytes\": " << bytes << ",\n"
+              << "  \"tokens\": " << tokens << ",\n";
+    if (tree) {
+        std::cout << "  \"nodes\": " << count_nodes(*tree) << ",\n";
+    }
+    if (dotBytes) {
+        std::cout << "  \"dot_bytes\": " << dotBytes << ",\n";
+    }
+    std::cout << "  \"reps\": " << reps << ",\n"
+              << "  \"stages\": {\n";
+#if defined(LEMON_PY_UNICODE_SUPPORT) || defined(LEMON_PY_UTF8_SUPPORT)
+    print_stage(std::cout, "decode", decodeTime, bytes, tokens);
+    std::cout << ",\n";
+#endif
+    print_stage(std::cout, "lex", lexTime, bytes, tokens);
+    std::cout << ",\n";
+    print_stage(std::cout, "parse", std::max(lexParseTime - lexTime, 1e-9), bytes, tokens);
+    if (!skip.count("uplift")) {
+        std::cout << ",\n";
+        print_stage(std::cout, "uplift", upliftTime, bytes, tokens);
+    }
+    if (!skip.count("dotify")) {
+        std::cout << ",\n";
+        print_stage(std::cout, "dotify", dotifyTime, bytes, tokens);
+    }
+    std::cout << "\n  }\n}\n";
+
+    return 0;
+}
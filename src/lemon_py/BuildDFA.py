@@ -0,0 +1,851 @@
+# MIT License
+
+# Copyright (c) 2021 Aubrey R Jones
+
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+'''
+Compiles lexer regular expressions into table-driven DFAs at grammar build time.
+
+Supports the commonly-used subset of the ECMAScript dialect accepted by
+`std::regex`: literals, escapes, `.`, bracket classes, groups,
+alternation, and greedy quantifiers. Anything else (anchors, assertions,
+lookahead, backreferences, lazy quantifiers) raises `UnsupportedRegex`,
+and the caller is expected to fall back to `std::regex` at runtime.
+
+Regexes are represented as little tuple trees:
+
+  ('chars', intervals)       -- match one code unit in the sorted, disjoint (lo, hi) intervals
+  ('cat', (node, ...))       -- concatenation
+  ('alt', (node, ...))       -- alternation
+  ('rep', node, min, max)    -- repetition, `max` is None for unbounded
+  ('group', node, index)     -- group, `index` is the capture number or 0 if non-capturing
+'''
+
+from typing import *
+from collections import deque
+import bisect
+
+MAX_REPEAT_EXPANSION = 256
+MAX_DFA_STATES = 0xFFFF
+
+
+class UnsupportedRegex(Exception):
+    '''
+    The regex uses a feature the DFA compiler can't represent.
+    '''
+    pass
+
+
+# ==================== CHARACTER SETS =======================
+
+def _normalize(intervals) -> tuple:
+    '''
+    Sort and merge overlapping or adjacent intervals.
+    '''
+    retval = []
+    for lo, hi in sorted(intervals):
+        if retval and lo <= retval[-1][1] + 1:
+            if hi > retval[-1][1]:
+                retval[-1] = (retval[-1][0], hi)
+        else:
+            retval.append((lo, hi))
+    return tuple(retval)
+
+
+def _negate(intervals, maxchar: int) -> tuple:
+    retval = []
+    nextlo = 0
+    for lo, hi in intervals:
+        if lo > nextlo:
+            retval.append((nextlo, lo - 1))
+        nextlo = hi + 1
+    if nextlo <= maxchar:
+        retval.append((nextlo, maxchar))
+    return tuple(retval)
+
+
+def _fold_ascii(intervals) -> tuple:
+    '''
+    Add the other-case counterpart of every ASCII letter in the set. This matches
+    `std::regex::icase` in the "C" locale, which only folds ASCII.
+    '''
+    extra = []
+    for lo, hi in intervals:
+        for base, other in ((ord('a'), ord('A')), (ord('A'), ord('a'))):
+            flo, fhi = max(lo, base), min(hi, base + 25)
+            if flo <= fhi:
+                extra.append((flo - base + other, fhi - base + other))
+    return _normalize(tuple(intervals) + tuple(extra))
+
+
+_DIGIT = ((ord('0'), ord('9')),)
+_WORD = _normalize([(ord('0'), ord('9')), (ord('A'), ord('Z')), (ord('_'), ord('_')), (ord('a'), ord('z'))])
+_SPACE = ((9, 13), (32, 32))
+
+_POSIX_CLASSES = {
+    'alpha': ((ord('A'), ord('Z')), (ord('a'), ord('z'))),
+    'digit': _DIGIT,
+    'alnum': ((ord('0'), ord('9')), (ord('A'), ord('Z')), (ord('a'), ord('z'))),
+    'upper': ((ord('A'), ord('Z')),),
+    'lower': ((ord('a'), ord('z')),),
+    'space': _SPACE,
+    'blank': ((9, 9), (32, 32)),
+    'punct': ((33, 47), (58, 64), (91, 96), (123, 126)),
+    'xdigit': ((ord('0'), ord('9')), (ord('A'), ord('F')), (ord('a'), ord('f'))),
+    'cntrl': ((0, 31), (127, 127)),
+    'print': ((32, 126),),
+    'graph': ((33, 126),),
+    'w': _WORD,
+    'd': _DIGIT,
+    's': _SPACE,
+}
+
+
+# ==================== REGEX PARSER =======================
+
+class _RegexParser:
+    '''
+    Recursive-descent parser for the supported ECMAScript subset.
+
+    A `lenient` parser also accepts the features the DFA compiler can't represent, standing in
+    something that starts with the same characters or more: assertions match the empty string,
+    lazy quantifiers are greedy, and backreferences match anything. The tree is then only good
+    for `regex_first_chars()`. What the assertions look at is kept in `assertions`, and whether
+    there's a `$` or a backreference in `unbounded`.
+    '''
+
+    def __init__(self, pattern: str, case_sensitive: bool, uni: bool, lenient: bool = False):
+        # in 8-bit mode, `std::regex` sees the UTF-8 bytes of the pattern as individual characters
+        self.p = [ord(c) for c in pattern] if uni else list(pattern.encode('utf-8'))
+        self.i = 0
+        self.icase = not case_sensitive
+        self.maxchar = 0x10FFFF if uni else 0xFF
+        self.groups = 0
+        self.lenient = lenient
+        self.assertions = [] # lookahead trees, in lenient mode
+        self.unbounded = False # saw `$` or a backreference, in lenient mode
+
+    def peek(self, offset = 0):
+        i = self.i + offset
+        return self.p[i] if i < len(self.p) else None
+
+    def take(self):
+        c = self.peek()
+        if c is None:
+            raise UnsupportedRegex("Unexpected end of pattern.")
+        self.i += 1
+        return c
+
+    def chars(self, intervals) -> tuple:
+        if self.icase:
+            intervals = _fold_ascii(intervals)
+        return ('chars', _normalize(intervals))
+
+    def parse(self) -> tuple:
+        node = self.parse_alt()
+        if self.peek() is not None:
+            raise UnsupportedRegex(f"Unexpected '{chr(self.peek())}'.")
+        return node
+
+    def parse_alt(self) -> tuple:
+        branches = [self.parse_cat()]
+        while self.peek() == ord('|'):
+            self.take()
+            branches.append(self.parse_cat())
+        return branches[0] if len(branches) == 1 else ('alt', tuple(branches))
+
+    def parse_cat(self) -> tuple:
+        items = []
+        while self.peek() is not None and self.peek() not in (ord('|'), ord(')')):
+            items.append(self.parse_repeat())
+        return items[0] if len(items) == 1 else ('cat', tuple(items))
+
+    def parse_count(self) -> Optional[tuple]:
+        '''
+        Parse a `{n}`, `{n,}`, or `{n,m}` quantifier, or return None if this isn't one.
+        '''
+        text = ''
+        j = self.i + 1
+        while j < len(self.p) and self.p[j] != ord('}'):
+            text += chr(self.p[j])
+            j += 1
+        if j >= len(self.p):
+            return None
+        lo, comma, hi = text.partition(',')
+        if not lo.isdigit() or (hi and not hi.isdigit()):
+            return None
+        self.i = j + 1
+        return (int(lo), int(hi) if hi else (None if comma else int(lo)))
+
+    def parse_repeat(self) -> tuple:
+        node = self.parse_atom()
+        c = self.peek()
+        if c == ord('*'):
+            bounds = (0, None)
+        elif c == ord('+'):
+            bounds = (1, None)
+        elif c == ord('?'):
+            bounds = (0, 1)
+        elif c == ord('{'):
+            bounds = self.parse_count()
+            if not bounds:
+                raise UnsupportedRegex("Malformed `{}` quantifier.")
+        else:
+            return node
+
+        if c != ord('{'): # `parse_count` already consumed the whole quantifier
+            self.take()
+
+        if self.peek() == ord('?'):
+            if not self.lenient:
+                raise UnsupportedRegex("Lazy quantifiers can't be represented by longest-match DFA.")
+            self.take()
+        if self.peek() in (ord('*'), ord('+'), ord('{')):
+            raise UnsupportedRegex("Nested quantifier.")
+        if bounds[1] is not None and bounds[0] > bounds[1]:
+            raise UnsupportedRegex("Quantifier bounds out of order.")
+        if max(bounds[0], bounds[1] or 0) > MAX_REPEAT_EXPANSION and not self.lenient:
+            raise UnsupportedRegex("Quantifier too large to expand.")
+        return ('rep', node, bounds[0], bounds[1])
+
+    def parse_atom(self) -> tuple:
+        c = self.take()
+        if c == ord('('):
+            index = 0
+            if self.peek() == ord('?'):
+                if self.lenient and self.peek(1) in (ord('='), ord('!')):
+                    self.i += 2
+                    self.assertions.append(self.parse_alt())
+                    if self.peek() != ord(')'):
+                        raise UnsupportedRegex("Unbalanced parentheses.")
+                    self.take()
+                    return _EMPTY
+                if self.peek(1) != ord(':'):
+                    raise UnsupportedRegex("Lookahead assertions are not supported.")
+                self.i += 2
+            else:
+                self.groups += 1
+                index = self.groups
+            node = self.parse_alt()
+            if self.peek() != ord(')'):
+                raise UnsupportedRegex("Unbalanced parentheses.")
+            self.take()
+            return ('group', node, index)
+        elif c == ord('['):
+            return self.parse_class()
+        elif c == ord('.'):
+            return ('chars', _negate(((10, 10), (13, 13)), self.maxchar))
+        elif c == ord('\\'):
+            if self.lenient and self.peek() in (ord('b'), ord('B')):
+                self.take()
+                return _EMPTY
+            if self.lenient and self.peek() in range(ord('1'), ord('9') + 1):
+                while self.peek() in range(ord('0'), ord('9') + 1):
+                    self.take()
+                self.unbounded = True
+                return ('rep', ('chars', ((0, self.maxchar),)), 0, None) # whatever the group matched, or nothing
+            return self.chars(self.parse_escape(False))
+        elif c in (ord('^'), ord('$')):
+            if self.lenient:
+                self.unbounded = self.unbounded or c == ord('$')
+                return _EMPTY
+            raise UnsupportedRegex("Anchors are not supported.")
+        elif c in (ord('*'), ord('+'), ord('?')):
+            raise UnsupportedRegex("Quantifier without a target.")
+        return self.chars(((c, c),))
+
+    def parse_hex(self, digits: int) -> int:
+        text = ''.join(chr(self.take()) for _ in range(digits))
+        try:
+            return int(text, 16)
+        except ValueError:
+            raise UnsupportedRegex("Malformed hex escape.")
+
+    def parse_escape(self, in_class: bool) -> tuple:
+        '''
+        Parse the escape sequence following a `\\`, returning a set of intervals.
+        '''
+        c = chr(self.take())
+        classes = {'d': _DIGIT, 'w': _WORD, 's': _SPACE}
+        simple = {'n': 10, 'r': 13, 't': 9, 'f': 12, 'v': 11}
+
+        if c in classes:
+            return classes[c]
+        elif c.lower() in classes:
+            return _negate(classes[c.lower()], self.maxchar)
+        elif c in simple:
+            cp = simple[c]
+        elif c == 'b' and in_class:
+            cp = 8
+        elif c in 'bB':
+            raise UnsupportedRegex("Word boundary assertions are not supported.")
+        elif c == '0' and not (self.peek() or 0) in range(ord('0'), ord('9') + 1):
+            cp = 0
+        elif c.isdigit():
+            raise UnsupportedRegex("Backreferences are not supported.")
+        elif c == 'x':
+            cp = self.parse_hex(2)
+        elif c == 'u':
+            cp = self.parse_hex(4)
+        elif c == 'c':
+            cp = self.take() % 32
+        else:
+            cp = ord(c)
+
+        if cp > self.maxchar:
+            raise UnsupportedRegex("Escaped character out of range.")
+        return ((cp, cp),)
+
+    def parse_class_char(self) -> tuple:
+        '''
+        Parse a single bracket expression element, returning its intervals and whether it's a single character.
+        '''
+        c = self.take()
+        if c == ord('\\'):
+            intervals = self.parse_escape(True)
+            return intervals, len(intervals) == 1 and intervals[0][0] == intervals[0][1]
+        if c == ord('[') and self.peek() in (ord(':'), ord('.'), ord('=')):
+            kind = self.take()
+            name = ''
+            while not (self.peek() == kind and self.peek(1) == ord(']')):
+                name += chr(self.take())
+            self.i += 2
+            if self.lenient and (kind != ord(':') or name not in _POSIX_CLASSES):
+                return ((0, self.maxchar),), False
+            if kind != ord(':') or name not in _POSIX_CLASSES:
+                raise UnsupportedRegex(f"Unsupported bracket expression [{chr(kind)}{name}{chr(kind)}].")
+            return _POSIX_CLASSES[name], False
+        return ((c, c),), True
+
+    def parse_class(self) -> tuple:
+        negated = False
+        if self.peek() == ord('^'):
+            self.take()
+            negated = True
+        if self.peek() == ord(']'):
+            raise UnsupportedRegex("Empty bracket expression.")
+
+        intervals = []
+        while self.peek() != ord(']'):
+            first, single = self.parse_class_char()
+            if single and self.peek() == ord('-') and self.peek(1) not in (None, ord(']')):
+                self.take()
+                last, last_single = self.parse_class_char()
+                if not last_single or last[0][0] < first[0][0]:
+                    raise UnsupportedRegex("Malformed range in bracket expression.")
+                intervals.append((first[0][0], last[0][0]))
+            else:
+                intervals.extend(first)
+        self.take()
+
+        intervals = _normalize(intervals)
+        if self.icase:
+            intervals = _fold_ascii(intervals)
+        if negated:
+            intervals = _negate(intervals, self.maxchar)
+        return ('chars', intervals)
+
+
+_EMPTY = ('cat', ()) # matches the empty string
+
+
+def _first(node: tuple) -> Tuple[tuple, bool]:
+    '''
+    Get the intervals a regex tree's matches can start with, and whether it can match the empty string.
+    '''
+    kind = node[0]
+    if kind == 'chars':
+        return (node[1], False)
+    if kind == 'group':
+        return _first(node[1])
+    if kind == 'rep':
+        chars, nullable = _first(node[1])
+        return (chars, nullable or node[2] == 0)
+    if kind == 'alt':
+        branches = [_first(n) for n in node[1]]
+        return (_normalize(c for chars, _ in branches for c in chars), any(nullable for _, nullable in branches))
+
+    chars = [] # 'cat'
+    for n in node[1]:
+        item, nullable = _first(n)
+        chars.extend(item)
+        if not nullable:
+            return (_normalize(chars), False)
+    return (_normalize(chars), True)
+
+
+def regex_first_chars(pattern: str, case_sensitive: bool, uni: bool) -> Optional[tuple]:
+    '''
+    Get the intervals of characters a nonempty match of a lexdef regex can start with, even if it
+    uses features the DFA compiler can't represent. Returns None if the pattern can't be parsed.
+    '''
+    try:
+        chars, _ = _first(_RegexParser(pattern, case_sensitive, uni, lenient = True).parse())
+    except UnsupportedRegex:
+        return None
+    if uni and not case_sensitive:
+        chars = _normalize(chars + ((0x80, 0x10FFFF),)) # leave non-ASCII case folding to `std::regex`
+    return chars
+
+
+def _all_chars(node: tuple):
+    '''
+    Yield every interval of characters anywhere in a regex tree.
+    '''
+    if node[0] == 'chars':
+        yield from node[1]
+    elif node[0] in ('group', 'rep'):
+        yield from _all_chars(node[1])
+    else: # 'alt' or 'cat'
+        for n in node[1]:
+            yield from _all_chars(n)
+
+
+def regex_spans_lines(pattern: str, case_sensitive: bool, uni: bool) -> bool:
+    '''
+    Could a lexdef regex match or look at a line break, or depend on where the input ends? True
+    if the pattern can't be parsed.
+    '''
+    try:
+        parser = _RegexParser(pattern, case_sensitive, uni, lenient = True)
+        trees = [parser.parse()] + parser.assertions
+    except UnsupportedRegex:
+        return True
+    return parser.unbounded or any(lo <= 10 <= hi for tree in trees for lo, hi in _all_chars(tree))
+
+
+def parse_regex(pattern: str, case_sensitive: bool, uni: bool) -> tuple:
+    '''
+    Parse a lexdef regex into a tree, raising `UnsupportedRegex` if it can't be compiled to a DFA.
+    '''
+    return _RegexParser(pattern, case_sensitive, uni).parse()
+
+
+def literal_regex(s: str, uni: bool) -> tuple:
+    '''
+    Make a regex tree exactly (and case-sensitively) matching the given string.
+    '''
+    units = [ord(c) for c in s] if uni else list(s.encode('utf-8'))
+    return ('cat', tuple(('chars', ((u, u),)) for u in units))
+
+
+def _utf8_encode(cp: int) -> list:
+    return list(chr(cp).encode('utf-8', 'surrogatepass'))
+
+
+def _utf8_sequences(lo: int, hi: int) -> list:
+    '''
+    Split a code point range into UTF-8 byte range sequences, each matching a run of code points
+    whose encodings are all the same length and differ only by a range in every byte.
+    Surrogates are left out, since they aren't valid in UTF-8.
+    '''
+    retval = []
+    stack = [(lo, hi)]
+    while stack:
+        lo, hi = stack.pop()
+        if lo > hi:
+            continue
+        if lo <= 0xDFFF and hi >= 0xD800:
+            stack += [(0xE000, hi), (lo, 0xD7FF)]
+            continue
+        split = next((m for m in (0x7F, 0x7FF, 0xFFFF) if lo <= m < hi), None)
+        if split is not None:
+            stack += [(split + 1, hi), (lo, split)]
+            continue
+        for i in (1, 2, 3):
+            mask = (1 << (6 * i)) - 1
+            if lo & ~mask != hi & ~mask:
+                if lo & mask:
+                    stack += [((lo | mask) + 1, hi), (lo, lo | mask)]
+                    break
+                if hi & mask != mask:
+                    stack += [(hi & ~mask, hi), (lo, (hi & ~mask) - 1)]
+                    break
+        else:
+            retval.append(tuple(zip(_utf8_encode(lo), _utf8_encode(hi))))
+    return retval
+
+
+def utf8_regex(node: tuple) -> tuple:
+    '''
+    Convert a regex tree over code points into one matching their UTF-8 encodings byte by byte.
+    '''
+    kind = node[0]
+    if kind == 'chars':
+        ascii = tuple((lo, min(hi, 0x7F)) for lo, hi in node[1] if lo <= 0x7F)
+        branches = [('chars', ascii)] if ascii else []
+        for lo, hi in node[1]:
+            for seq in _utf8_sequences(max(lo, 0x80), hi):
+                branches.append(('cat', tuple(('chars', (r,)) for r in seq)))
+        if len(branches) == 1 and branches[0][0] == 'chars':
+            return branches[0]
+        return ('alt', tuple(branches)) if branches else ('chars', ())
+    if kind in ('cat', 'alt'):
+        return (kind, tuple(map(utf8_regex, node[1])))
+    if kind == 'rep':
+        return ('rep', utf8_regex(node[1]), node[2], node[3])
+    if kind == 'group':
+        return ('group', utf8_regex(node[1]), node[2])
+    return node
+
+
+def utf8_lead_bytes(intervals: tuple) -> Optional[tuple]:
+    '''
+    Get the bytes that can start the UTF-8 encoding of a code point in `intervals`, when that's
+    enough to decide membership in valid UTF-8: the set must hold either none or all of the
+    non-ASCII code points. Returns None otherwise.
+    '''
+    ascii = tuple((lo, min(hi, 0x7F)) for lo, hi in intervals if lo <= 0x7F)
+    wide = _normalize((max(lo, 0x80), hi) for lo, hi in intervals if hi > 0x7F)
+    if not wide:
+        return ascii
+    if _normalize(wide + ((0xD800, 0xDFFF),)) == ((0x80, 0x10FFFF),):
+        return _normalize(ascii + ((0x80, 0xFF),))
+    return None
+
+
+def split_capture(node: tuple) -> Optional[tuple]:
+    '''
+    Split a regex into (prefix, group, suffix) around its first capture group, or return
+    None if it has no capture group. Raises `UnsupportedRegex` if the first group isn't
+    a direct element of the top-level concatenation.
+    '''
+    def has_group(n) -> bool:
+        kind = n[0]
+        if kind == 'group':
+            return n[2] > 0 or has_group(n[1])
+        if kind in ('cat', 'alt'):
+            return any(map(has_group, n[1]))
+        if kind == 'rep':
+            return has_group(n[1])
+        return False
+
+    if not has_group(node):
+        return None
+
+    items = node[1] if node[0] == 'cat' else (node,)
+    for i, item in enumerate(items):
+        if item[0] == 'group' and item[2] == 1:
+            return (('cat', items[:i]), item[1], ('cat', items[i + 1:]))
+        if has_group(item):
+            break
+    raise UnsupportedRegex("Capture group must be a top-level element of the pattern.")
+
+
+def reverse_regex(node: tuple) -> tuple:
+    '''
+    Make a regex matching the reverse of every string matched by `node`.
+    '''
+    kind = node[0]
+    if kind == 'cat':
+        return ('cat', tuple(reverse_regex(n) for n in reversed(node[1])))
+    if kind == 'alt':
+        return ('alt', tuple(map(reverse_regex, node[1])))
+    if kind == 'rep':
+        return ('rep', reverse_regex(node[1]), node[2], node[3])
+    if kind == 'group':
+        return ('group', reverse_regex(node[1]), node[2])
+    return node
+
+
+# ==================== NFA =======================
+
+class _NFA:
+    '''
+    Thompson NFA over character intervals.
+    '''
+
+    def __init__(self):
+        self.eps = []
+        self.edges = []
+        self.accepts = {}
+
+    def state(self) -> int:
+        self.eps.append([])
+        self.edges.append([])
+        return len(self.eps) - 1
+
+    def build(self, node: tuple, s: int) -> int:
+        '''
+        Add the fragment for `node` starting at state `s`, returning its end state.
+        '''
+        kind = node[0]
+        if kind == 'chars':
+            e = self.state()
+            if node[1]:
+                self.edges[s].append((node[1], e))
+            return e
+        elif kind == 'cat':
+            for n in node[1]:
+                s = self.build(n, s)
+            return s
+        elif kind == 'alt':
+            e = self.state()
+            for n in node[1]:
+                bs = self.state()
+                self.eps[s].append(bs)
+                self.eps[self.build(n, bs)].append(e)
+            return e
+        elif kind == 'group':
+            return self.build(node[1], s)
+        elif kind == 'rep':
+            _, child, lo, hi = node
+            for _ in range(lo):
+                s = self.build(child, s)
+            if hi is None:
+                loop = self.state()
+                self.eps[s].append(loop)
+                self.eps[self.build(child, loop)].append(loop)
+                return loop
+            e = self.state()
+            for _ in range(hi - lo):
+                self.eps[s].append(e)
+                s = self.build(child, s)
+            self.eps[s].append(e)
+            return e
+        raise RuntimeError(f"Unknown regex node {kind}.")
+
+    def closure(self, states) -> frozenset:
+        seen = set(states)
+        stack = list(states)
+        while stack:
+            for t in self.eps[stack.pop()]:
+                if t not in seen:
+                    seen.add(t)
+                    stack.append(t)
+        return frozenset(seen)
+
+
+# ==================== DFA =======================
+
+class DFA:
+    '''
+    A minimized DFA. State 0 is dead, state 1 is the start state.
+
+    `classes` maps each code unit interval (lo, hi) to its equivalence class.
+    `trans[state][cls]` is the next state. `accepts[state]` is the tuple of accepted rules, in priority order.
+    '''
+
+    def __init__(self, intervals, classes, trans, accepts):
+        self.intervals = intervals
+        self.classes = classes
+        self.trans = trans
+        self.accepts = accepts
+
+    @property
+    def class_count(self) -> int:
+        return max(self.classes) + 1
+
+    def class_of(self, cu: int) -> int:
+        return self.classes[bisect.bisect_right(self.intervals, (cu, float('inf'))) - 1]
+
+
+def build_dfa(rules: List[tuple], maxchar: int, final_rules = None) -> DFA:
+    '''
+    Build a minimal DFA recognizing all `rules` (regex trees) at once. Rule indices are their
+    priority, lower first. An accepting state lists every rule it accepts, but the list is
+    cut short after the first rule in `final_rules` (a rule that always accepts when matched,
+    making lower-priority rules in that state unreachable). By default all rules are final.
+    '''
+    final_rules = set(range(len(rules))) if final_rules is None else set(final_rules)
+
+    nfa = _NFA()
+    start = nfa.state()
+    for index, node in enumerate(rules):
+        rs = nfa.state()
+        nfa.eps[start].append(rs)
+        nfa.accepts[nfa.build(node, rs)] = index
+
+    # split the code unit range into atoms, so that every edge covers whole atoms
+    bounds = {0, maxchar + 1}
+    if maxchar > 0xFF:
+        bounds.add(0x100)
+    for edges in nfa.edges:
+        for intervals, _ in edges:
+            for lo, hi in intervals:
+                bounds.add(lo)
+                bounds.add(hi + 1)
+    bounds = sorted(bounds)
+    atom_count = len(bounds) - 1
+
+    atom_edges = []
+    for edges in nfa.edges:
+        converted = []
+        for intervals, target in edges:
+            atoms = []
+            for lo, hi in intervals:
+                atoms.extend(range(bisect.bisect_left(bounds, lo), bisect.bisect_left(bounds, hi + 1)))
+            converted.append((atoms, target))
+        atom_edges.append(converted)
+
+    # subset construction
+    def accept_of(nstates) -> tuple:
+        retval = []
+        for r in sorted(nfa.accepts[s] for s in nstates if s in nfa.accepts):
+            retval.append(r)
+            if r in final_rules:
+                break
+        return tuple(retval)
+
+    start_set = nfa.closure([start])
+    dstates = {frozenset(): 0, start_set: 1}
+    order = [frozenset(), start_set]
+    trans = [[0] * atom_count, None]
+    queue = deque([start_set])
+    while queue:
+        current = queue.popleft()
+        moves = {}
+        for s in current:
+            for atoms, target in atom_edges[s]:
+                for a in atoms:
+                    moves.setdefault(a, set()).add(target)
+        row = [0] * atom_count
+        closures = {}
+        for a, targets in moves.items():
+            key = frozenset(targets)
+            if key not in closures:
+                closures[key] = nfa.closure(targets)
+            dest = closures[key]
+            if dest not in dstates:
+                dstates[dest] = len(order)
+                order.append(dest)
+                trans.append(None)
+                queue.append(dest)
+            row[a] = dstates[dest]
+        trans[dstates[current]] = row
+
+    accepts = [accept_of(s) for s in order]
+
+    # minimize by partition refinement, with all dead states kept in a single block
+    live = _coreachable(trans, accepts)
+    initial = {}
+    block = [initial.setdefault(accepts[s] if s in live else None, len(initial)) for s in range(len(order))]
+    block_count = len(initial)
+    while True:
+        signatures = {}
+        new_block = []
+        for s in range(len(order)):
+            sig = (block[s], tuple(block[t] for t in trans[s])) if s in live else None
+            new_block.append(signatures.setdefault(sig, len(signatures)))
+        block = new_block
+        if len(signatures) == block_count:
+            break
+        block_count = len(signatures)
+
+    # renumber: dead 0, start 1, the rest in discovery order
+    numbering = {block[0]: 0}
+    if block[1] not in numbering:
+        numbering[block[1]] = 1
+    for s in range(len(order)):
+        if block[s] not in numbering:
+            numbering[block[s]] = len(numbering)
+    state_count = len(numbering)
+    if state_count > MAX_DFA_STATES:
+        raise RuntimeError(f"Lexer DFA is too large ({state_count} states).")
+
+    min_trans = [None] * state_count
+    min_accepts = [()] * state_count
+    min_trans[0] = [0] * atom_count
+    for s in range(len(order)):
+        m = numbering[block[s]]
+        if min_trans[m] is None:
+            min_trans[m] = [numbering[block[t]] for t in trans[s]]
+            min_accepts[m] = accepts[s] if s in live else ()
+
+    # merge atoms with identical columns into character classes
+    columns = {}
+    atom_class = []
+    for a in range(atom_count):
+        col = tuple(row[a] for row in min_trans)
+        atom_class.append(columns.setdefault(col, len(columns)))
+    class_trans = [[0] * len(columns) for _ in range(state_count)]
+    for s in range(state_count):
+        for a in range(atom_count):
+            class_trans[s][atom_class[a]] = min_trans[s][a]
+
+    intervals = [(bounds[a], bounds[a + 1] - 1) for a in range(atom_count)]
+    return DFA(intervals, atom_class, class_trans, min_accepts)
+
+
+def _coreachable(trans, accepts) -> set:
+    '''
+    Find the states that can reach an accepting state.
+    '''
+    reverse = [[] for _ in trans]
+    for s, row in enumerate(trans):
+        for t in set(row):
+            reverse[t].append(s)
+    live = set(s for s in range(len(trans)) if accepts[s])
+    stack = list(live)
+    while stack:
+        for p in reverse[stack.pop()]:
+            if p not in live:
+                live.add(p)
+                stack.append(p)
+    live.discard(0)
+    return live
+
+
+# ==================== C++ EMISSION =======================
+
+def _c_array(ctype: str, name: str, values: Iterable[int], per_line = 24) -> str:
+    values = list(values)
+    if not values:
+        values = [0]
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append('    ' + ', '.join(map(str, values[i:i + per_line])))
+    return f"static const {ctype} {name}[{len(values)}] = {{\n" + ",\n".join(lines) + "\n};\n"
+
+
+def emit_dfa(name: str, dfa: DFA) -> str:
+    '''
+    Emit C++ static arrays and a `DFATable` named `name` for the given DFA.
+    '''
+    class_map = [dfa.class_of(cu) for cu in range(256)]
+
+    ranges = []
+    for (lo, hi), cls in zip(dfa.intervals, dfa.classes):
+        if lo < 0x100:
+            continue
+        if ranges and ranges[-1][2] == cls and ranges[-1][1] + 1 == lo:
+            ranges[-1] = (ranges[-1][0], hi, cls)
+        else:
+            ranges.append((lo, hi, cls))
+
+    accept_begin = [0]
+    accept_rules = []
+    for a in dfa.accepts:
+        accept_rules.extend(a)
+        accept_begin.append(len(accept_rules))
+
+    retval = f"// {len(dfa.trans)} states, {dfa.class_count} character classes\n"
+    retval += _c_array('uint16_t', f"{name}_classes", class_map)
+    if ranges:
+        retval += f"static const DFAClassRange {name}_ranges[{len(ranges)}] = {{\n"
+        retval += ",\n".join(f"    {{{lo}, {hi}, {cls}}}" for lo, hi, cls in ranges) + "\n};\n"
+    retval += _c_array('uint16_t', f"{name}_transitions", [t for row in dfa.trans for t in row])
+    retval += _c_array('uint16_t', f"{name}_accept_begin", accept_begin)
+    retval += _c_array('uint16_t', f"{name}_accept_rules", accept_rules)
+
+    range_ptr = f"{name}_ranges" if ranges else "nullptr"
+    retval += f"static const DFATable {name} = {{ {dfa.class_count}, {name}_classes, {range_ptr}, {len(ranges)}, " \
+              f"{name}_transitions, {name}_accept_begin, {name}_accept_rules }};\n\n"
+    return retval
@@ -30,6 +30,9 @@ import shutil
 import sys
 from typing import *
 
+import re
+import hashlib
+
 from .BuildLexer import make_lexer
 
 __all__ = ['build_lempy_grammar']
@@ -150,6 +153,16 @@ def _concatenate_implementation(**kwargs):
     if kwargs.get('suppress_python', False):
         retval += '#define LEMON_PY_SUPPRESS_PYTHON 1\n\n'
     
+    if kwargs.get('use_unicode', False) and kwargs.get('use_utf8', False):
+        raise RuntimeError("Choose one of `--unicode` and `--utf8`.")
+
+    if kwargs.get('profile', False):
+        retval += '#define LEMON_PY_PROFILE 1\n\n'
+
+    if kwargs.get('use_utf8', False):
+        retval += '#define LEMON_PY_UTF8_SUPPORT 1\n\n'
+        static_impl_text = static_impl_text.replace('struct _utf_include_replace_struct{};\n', _read_all(_data_file("utf.hpp")))
+
     if kwargs.get('use_unicode', False):
         retval += '#define LEMON_PY_UNICODE_SUPPORT 1\n\n'
         static_impl_text = static_impl_text.replace('struct _utf_include_replace_struct{};\n', _read_all(_data_file("utf.hpp")))
@@ -178,17 +191,55 @@ def _extract_module(text: str):
     return linesplit[1].strip()
 
 
+PRODUCTION_NAME_REGEX = re.compile(r'\b_\(\s*("(?:[^"\\\n]|\\.)*")')
+
+
+def _make_production_names(text: str):
+    '''
+    Find the string-literal production names used in the grammar actions (like `_("expr", ...)`),
+    and output a table of them so they get fixed symbol ids.
+    '''
+    names = []
+    for m in PRODUCTION_NAME_REGEX.finditer(text):
+        if m.group(1) not in names:
+            names.append(m.group(1))
+
+    retval = "namespace _parser_impl {\n"
+    retval += "char const* const _production_names[] = {" + "".join(f"{n}, " for n in names) + "nullptr};\n"
+    retval += f"size_t const _production_name_count = {len(names)};\n"
+    retval += "} //namespace\n"
+    return retval
+
+
+def _make_grammar_fingerprint(grammar_text: str, **kwargs):
+    '''
+    Hash everything that decides what trees the parser builds: the rendered grammar, the parser
+    implementation and template, and the text mode. Saved trees are only reused by a parser with
+    the same fingerprint.
+    '''
+    h = hashlib.sha256(grammar_text.encode('utf-8'))
+    for source in ["ParserImpl.cpp", "ParseNode.hpp", "lempar.c"]:
+        h.update(_read_all(_data_file(source)).encode('utf-8'))
+    h.update(f"unicode={kwargs.get('use_unicode', False)} utf8={kwargs.get('use_utf8', False)}".encode('utf-8'))
+
+    retval = "namespace _parser_impl {\n"
+    retval += f'char const* const _grammar_fingerprint = "{h.hexdigest()[:32]}";\n'
+    retval += "} //namespace\n"
+    return retval
+
+
 def _render_lemon_input(grammar_file_path: str, **kwargs):
     '''
     Render the input meant for `lemon`.
     '''
     user_input = _read_all(grammar_file_path)
     mod = _extract_module(user_input)
-    lexer_def, lexer_report = make_lexer(user_input, kwargs.get('use_unicode', False))
-    codegen_text = f"%include {{\n{lexer_def}\n}}\n"
-
+    lexer_def, lexer_report = make_lexer(user_input, kwargs.get('use_unicode', False), kwargs.get('use_utf8', False))
     header_text = _read_all(GRAMMAR_HEADER_FILE)
 
+    fingerprint = _make_grammar_fingerprint(user_input + lexer_def + header_text, **kwargs)
+    codegen_text = f"%include {{\n{lexer_def}\n{_make_production_names(user_input)}{fingerprint}}}\n"
+
     return (mod, user_input + codegen_text + header_text, lexer_report)
 
 
@@ -272,6 +323,8 @@ if __name__ == '__main__':
     import argparse
     ap = argparse.ArgumentParser(description="Build a grammar and optionally install it to the python path.")
     ap.add_argument('--unicode', default=False, const=True, action='store_const', help="Enable unicode support. This is necessary for reliable non-ASCII input, but increases memory usage in the resulting parser.")
+    ap.add_argument('--utf8', default=False, const=True, action='store_const', help="Enable unicode support that lexes UTF-8 directly, without converting the input. Regex fallbacks still see bytes.")
+    ap.add_argument('--profile', default=False, const=True, action='store_const', help="Compile in lexer and parser counters, read back with `stats()`. Slows parsing down.")
     ap.add_argument('--cpp', type=str, required=False, help="Specify to output C++ compatible files to the indicated directory. Disables building the Python module.")
     ap.add_argument('--terminals', default=False, const=True, action='store_const', help="Print a skeleton `@lexdef` including all grammar-defined terminals.")
     ap.add_argument('--debug', default=False, const=True, action='store_const', help="Don't use a temp directory, dump everything in cwd.")
@@ -285,6 +338,8 @@ if __name__ == '__main__':
     func_args = { 
         'install' : not args.noinstall, 
         'use_unicode' : args.unicode, 
+        'use_utf8' : args.utf8,
+        'profile' : args.profile,
         'cpp_dir' : os.path.abspath(args.cpp) if building_cpp else None, 
         'suppress_python' : building_cpp,
         'no_build' : args.nobuild,
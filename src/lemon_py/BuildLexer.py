@@ -23,14 +23,17 @@
 from typing import *
 import re
 
-LEXER_START = \
+from .BuildDFA import UnsupportedRegex, parse_regex, regex_first_chars, regex_spans_lines, literal_regex, split_capture, reverse_regex, build_dfa, emit_dfa, _negate, \
+    utf8_regex, utf8_lead_bytes, _utf8_encode
+
+LEXER_TABLES_START = \
 '''
 namespace _parser_impl {
-void _init_lexer() {
-    static bool isInit = false;
-    if (isInit) return;
-    isInit = true;
+'''
 
+LEXER_START = \
+'''
+void _init_lexer(LexerDef & lexer) {
 '''
 LEXER_END = \
 '''
@@ -59,7 +62,7 @@ def scan_regex(s: str) -> tuple: # input should _not_ be stripped!
     if matchtype == ':':
         flags = 'RegexScannerFlags::CaseSensitive'
         s = s[1:]
-    return (escape_backslash(s.strip()), flags)
+    return (s.strip(), flags)
 
 
 def scan_literal(s: str) -> tuple: # input should _not_ be stripped!
@@ -68,14 +71,14 @@ def scan_literal(s: str) -> tuple: # input should _not_ be stripped!
     terminal_pattern_start = re.search(INTRO_REGEX_REGEX, s)
     
     if not terminal_pattern_start:  # just take everything as the search string
-        return (escape_backslash(s[1:].strip()), None)
+        return (s[1:].strip(), None)
     
     stringlit = s[1:terminal_pattern_start.span(1)[0]].strip()
     relit = s[terminal_pattern_start.span(1)[1]:]
 
     terminator = scan_regex(relit)
     
-    return (escape_backslash(stringlit), terminator)
+    return (stringlit, terminator)
 
 def scan_lex_line(l: str) -> tuple:
     l = l.strip()
@@ -125,7 +128,7 @@ def decode_stringdef(tokname, code) -> str:
     if 'j' in special:
         flags += " | StringScannerFlags::JoinAdjacent"
 
-    return f"Lexer::add_string_def('{delim}', '{escape}', {tokname}, {flags});\n"
+    return f"lexer.add_string_def('{delim}', '{escape}', {tokname}, {flags});\n"
 
 def cstring(s: str, uni: bool) -> str:
     if uni:
@@ -133,38 +136,362 @@ def cstring(s: str, uni: bool) -> str:
     else:
         return f'"{s}"'
 
-def implement_lexdef_line(lexdef: tuple, uni: bool) -> str:
-    cs = lambda s: cstring(s, uni)
-    retval = '' + TABBY
-    kind = lexdef[0]
-    tokname = lexdef[1]
-    if kind == 'skip':
-        skipre = lexdef[2]
-        retval += f"Lexer::add_skip({cs(skipre[0])}, {skipre[1]});\n"
-    elif kind == 'value':
-        retval += f"Lexer::add_value_type({tokname}, {cs(lexdef[2])}, {lexdef[3]});\n"
-    elif kind == 'literal':
-        if lexdef[3]:
-            termre = lexdef[3]
-            retval += f"Lexer::add_literal({tokname}, {cs(lexdef[2])}, {cs(termre[0])}, {termre[1]});\n"
-        else:
-            retval += f"Lexer::add_literal({tokname}, {cs(lexdef[2])});\n"
-    elif kind == 'string':
-        retval += decode_stringdef(lexdef[1], lexdef[2])
-    
-    if kind not in ('skip'):
-        retval += TABBY + f"token_name_map.emplace({tokname}, {cs(tokname)});\n"
+class LexRule:
+    '''
+    A skip, literal, or value definition, along with everything needed to emit its `LexRule` table entry.
+    '''
+    def __init__(self, kind: str, tokname: str, rank: int, regex: tuple):
+        self.kind = kind
+        self.tokname = tokname
+        self.rank = rank
+        self.regex = regex # tree for the lexer DFA, or None if this rule uses a `std::regex` pattern
+        self.pattern = -1
+        self.terminator = 'nullptr'
+        self.terminator_class = 'nullptr'
+        self.terminator_pattern = -1
+        self.capture = 'nullptr'
+        self.shape = None # `SkipScanner` shape for skips, see `skip_scanner_shape()`
+        self.scanner = 'nullptr'
+        self.first = 'nullptr' # `CharSet` of what a `std::regex` fallback's match can start with
+        self.spans_lines = 'false' # can a `std::regex` fallback match past a line break?
+
+    def cpp(self) -> str:
+        kind = {'skip': 'LexRuleKind::Skip', 'literal': 'LexRuleKind::Literal', 'value': 'LexRuleKind::Value'}[self.kind]
+        tokcode = '0' if self.kind == 'skip' else self.tokname
+        return f"{{{kind}, {tokcode}, {self.rank}, {self.pattern}, {self.terminator}, {self.terminator_class}, {self.terminator_pattern}, {self.capture}, {self.scanner}, {self.first}, {self.spans_lines}, \"{escape_backslash(self.tokname)}\"}},"
+
+
+def _try_regex(pattern: str, flags: str, uni: bool) -> Optional[tuple]:
+    '''
+    Parse a lexdef regex for the DFA compiler, or return None if it needs the `std::regex` fallback.
+    '''
+    try:
+        return parse_regex(pattern, flags == 'RegexScannerFlags::CaseSensitive', uni)
+    except UnsupportedRegex:
+        return None
+
+
+# `std::regex` spellings of "any character", for block comments like `/\*[\s\S]*?\*/`
+_ANY_CHAR_CLASSES = ('[\\s\\S]', '[\\S\\s]', '[\\w\\W]', '[\\W\\w]', '[\\d\\D]', '[\\D\\d]')
+
+
+def _flatten_cat(node: tuple) -> list:
+    '''
+    Get the sequence of regex tree nodes matched one after another, looking through groups.
+    '''
+    if node[0] == 'group':
+        return _flatten_cat(node[1])
+    if node[0] == 'cat':
+        return [item for n in node[1] for item in _flatten_cat(n)]
+    return [node]
 
+
+def _literal_codes(nodes: list) -> Optional[list]:
+    '''
+    Get the code units of a sequence of regex tree nodes matching one fixed string, or None.
+    '''
+    retval = []
+    for n in nodes:
+        if n[0] != 'chars' or len(n[1]) != 1 or n[1][0][0] != n[1][0][1]:
+            return None
+        retval.append(n[1][0][0])
     return retval
 
+
+def _contains(intervals: tuple, c: int) -> bool:
+    return any(lo <= c <= hi for lo, hi in intervals)
+
+
+def skip_scanner_shape(regex: Optional[tuple], pattern: str, flags: str, uni: bool) -> Optional[tuple]:
+    '''
+    Recognize a skip pattern that a `SkipScanner` can match exactly, returning its
+    `(kind, intervals, prefix, suffix)` or None. The shapes are:
+
+        Run:    `\s+` or `[ \t]`, a run of characters
+        Line:   `//.*\n` or `#.*`, a fixed prefix, then anything but the stop characters
+                in `intervals`, then optionally a single stop character
+        Block:  `/\*[\s\S]*?\*/`, a fixed prefix, then anything up to and including a
+                fixed suffix. Lazy repeats need `std::regex`, so these are found in `pattern`.
+    '''
+    if regex:
+        items = _flatten_cat(regex)
+        if len(items) == 1:
+            node = items[0]
+            if node[0] == 'rep' and node[2] <= 1 and node[3] is None:
+                node = _flatten_cat(node[1])
+                node = node[0] if len(node) == 1 else ('cat',)
+            if node[0] == 'chars' and node[1]:
+                return ('Run', node[1], [], [])
+            return None
+
+        reps = [i for i, n in enumerate(items) if n[0] != 'chars']
+        if len(reps) != 1:
+            return None
+        i = reps[0]
+        body = items[i]
+        body = body if body[0] != 'rep' else (body[0], _flatten_cat(body[1]), body[2], body[3])
+        if body[0] != 'rep' or body[2] != 0 or body[3] is not None or len(body[1]) != 1 or body[1][0][0] != 'chars':
+            return None
+        prefix, suffix = _literal_codes(items[:i]), _literal_codes(items[i + 1:])
+        stop = _negate(body[1][0][1], 0x10FFFF if uni else 0xFF)
+        if not prefix or not stop or len(suffix) > 1 or (suffix and not _contains(stop, suffix[0])):
+            return None
+        return ('Line', stop, prefix, suffix)
+
+    case_sensitive = flags == 'RegexScannerFlags::CaseSensitive'
+    for any_char in _ANY_CHAR_CLASSES:
+        head, sep, tail = pattern.partition(any_char + '*?')
+        if not sep or not head or not tail or head.endswith('\\'):
+            continue
+        try:
+            prefix = _literal_codes(_flatten_cat(parse_regex(head, True, uni)))
+            suffix = _literal_codes(_flatten_cat(parse_regex(tail, True, uni)))
+        except UnsupportedRegex:
+            return None
+        if not prefix or not suffix:
+            return None
+        if not case_sensitive and any(chr(c).isalpha() for c in prefix + suffix):
+            return None # leave case folding to `std::regex`
+        return ('Block', (), prefix, suffix)
+    return None
+
+
+def utf8_skip_scanner_shape(shape: Optional[tuple]) -> Optional[tuple]:
+    '''
+    Convert a skip scanner shape over code points into one over UTF-8 bytes, or return None
+    if it can't be matched a byte at a time.
+    '''
+    if not shape:
+        return None
+    kind, intervals, prefix, suffix = shape
+    if intervals:
+        intervals = utf8_lead_bytes(intervals)
+        if intervals is None:
+            return None
+    prefix, suffix = [b for c in prefix for b in _utf8_encode(c)], [b for c in suffix for b in _utf8_encode(c)]
+    if kind == 'Line' and len(suffix) > 1:
+        return None
+    return (kind, intervals, prefix, suffix)
+
+
+def _first_chars(shape: tuple) -> tuple:
+    '''
+    Get the intervals of code units a skip scanner's match can start with.
+    '''
+    kind, intervals, prefix, _ = shape
+    return intervals if kind == 'Run' else ((prefix[0], prefix[0]),)
+
+
+def char_set(name: str, intervals: tuple) -> tuple:
+    '''
+    Emit the range table named `name` for a C++ `CharSet`, returning it along with the set's initializer.
+    '''
+    bits = [0] * 8
+    for lo, hi in intervals:
+        for c in range(lo, min(hi, 255) + 1):
+            bits[c >> 5] |= 1 << (c & 31)
+    ranges = f"static const CharRange {name}[] = {{{', '.join(f'{{{lo}, {hi}}}' for lo, hi in intervals)}}};\n"
+    return (ranges, f"{{{{{', '.join(f'{b:#x}u' for b in bits)}}}, {name}, {len(intervals)}}}")
+
+
+def terminator_class(pattern: str, flags: str, uni: bool) -> Optional[tuple]:
+    '''
+    Recognize a literal terminator that only looks at the next character, returning the
+    `(intervals, at_end)` of a `TerminatorClass`, or None. That's either a character class like
+    `[^\w_]`, or a negative lookahead for one like `(?!\+)`, which also matches at the end of input.
+    '''
+    negative = pattern.startswith('(?!') and pattern.endswith(')')
+    try:
+        node = _flatten_cat(parse_regex(pattern[3:-1] if negative else pattern, flags == 'RegexScannerFlags::CaseSensitive', uni))
+    except UnsupportedRegex:
+        return None
+    if len(node) != 1 or node[0][0] != 'chars' or not node[0][1]:
+        return None
+    if negative:
+        if uni and flags != 'RegexScannerFlags::CaseSensitive' and any(lo > 0x7F for lo, _ in node[0][1]):
+            return None # leave non-ASCII case folding to `std::regex`
+        return (_negate(node[0][1], 0x10FFFF if uni else 0xFF), True)
+    return (node[0][1], False)
+
+
+def emit_skip_scanner(name: str, shape: tuple, rule: int) -> str:
+    '''
+    Emit the C++ `SkipScanner` for a shape found by `skip_scanner_shape()`, scanning for the skip at index `rule` of the rule table.
+    '''
+    kind, intervals, prefix, suffix = shape
+    retval = ''
+    charset = 'nullptr'
+    if intervals:
+        ranges, init = char_set(f"{name}_ranges", intervals)
+        retval += ranges + f"static const CharSet {name}_set = {init};\n"
+        charset = f"&{name}_set"
+    codes = lambda s: '{' + ', '.join(str(c) for c in s + [0]) + '}'
+    retval += f"static const uuchar {name}_prefix[] = {codes(prefix)};\n"
+    retval += f"static const uuchar {name}_suffix[] = {codes(suffix)};\n"
+    retval += f"static const SkipScanner {name} = {{SkipScannerKind::{kind}, {charset}, {name}_prefix, {len(prefix)}, {name}_suffix, {len(suffix)}, {rule}}};\n\n"
+    return retval
+
+
+def compile_lexer_tables(lexdefs: List[tuple], uni: bool, utf8: bool = False) -> tuple:
+    '''
+    Compile all skip, literal, and value definitions into a single lexer DFA plus
+    the auxiliary terminator and capture DFAs.
+
+    With `utf8`, patterns are parsed as code points like `uni`, but the tables match their
+    UTF-8 encodings a byte at a time.
+
+    Returns the C++ table definitions, and the `_init_lexer()` lines registering them along
+    with any `std::regex` fallback patterns.
+    '''
+    cs = lambda s: cstring(escape_backslash(s), uni)
+    maxchar = 0x10FFFF if uni else 0xFF
+    wide = uni or utf8 # parse patterns as code points?
+    encode = lambda node: utf8_regex(node) if utf8 and node else node
+    patterns = []
+    tables = ''
+
+    def fallback(pattern: str, flags: str) -> int:
+        patterns.append(f"{cs(pattern)}, {flags}")
+        return len(patterns) - 1
+
+    def fallback_first(rule: LexRule, pattern: str, flags: str):
+        '''
+        Emit the first characters of a fallback rule's matches, so the lexer only runs its `std::regex` where it could match.
+        Also note whether a stream has to be read to its end to be sure of the match.
+        '''
+        nonlocal tables
+        if regex_spans_lines(pattern, flags == 'RegexScannerFlags::CaseSensitive', uni):
+            rule.spans_lines = 'true'
+        chars = regex_first_chars(pattern, flags == 'RegexScannerFlags::CaseSensitive', uni)
+        if chars is None:
+            return
+        name = f"_lexfirst{len(rules) - 1}"
+        if chars:
+            ranges, init = char_set(f"{name}_ranges", chars)
+            tables += ranges + f"static const CharSet {name} = {init};\n\n"
+        else: # only ever matches the empty string, which the lexer ignores
+            tables += f"static const CharSet {name} = {{{{0u}}, nullptr, 0}};\n\n"
+        rule.first = f"&{name}"
+
+    # priority order: skips, then literals (longest match among them), then values in definition order
+    rules = []
+    for ld in filter(lambda ld: ld[0] == 'skip', lexdefs):
+        regex = _try_regex(*ld[2], wide)
+        rules.append(LexRule('skip', ld[1], 0, encode(regex)))
+        if not regex:
+            rules[-1].pattern = fallback(*ld[2])
+            fallback_first(rules[-1], *ld[2])
+        rules[-1].shape = skip_scanner_shape(regex, *ld[2], wide)
+        if utf8:
+            rules[-1].shape = utf8_skip_scanner_shape(rules[-1].shape)
+
+    seen_literals = {}
+    for ld in filter(lambda ld: ld[0] == 'literal', lexdefs):
+        if not ld[2]:
+            raise RuntimeError(f"Empty literal defined for {ld[1]}.")
+        if ld[2] in seen_literals:
+            raise RuntimeError(f"Attempting to redefine lexer literal {seen_literals[ld[2]]} as {ld[1]}.")
+        seen_literals[ld[2]] = ld[1]
+        rules.append(LexRule('literal', ld[1], 1, literal_regex(ld[2], uni)))
+        if ld[3]:
+            terminator = encode(_try_regex(*ld[3], wide))
+            single = terminator_class(*ld[3], wide)
+            if single and utf8:
+                single = (utf8_lead_bytes(single[0]), single[1])
+            if single and single[0]:
+                name = f"_lexterm{len(rules) - 1}"
+                ranges, init = char_set(f"{name}_ranges", single[0])
+                tables += ranges + f"static const TerminatorClass {name} = {{{init}, {'true' if single[1] else 'false'}}};\n\n"
+                rules[-1].terminator_class = f"&{name}"
+            elif terminator:
+                name = f"_lexdfa_term{len(rules) - 1}"
+                tables += emit_dfa(name, build_dfa([terminator], maxchar))
+                rules[-1].terminator = f"&{name}"
+            else:
+                rules[-1].terminator_pattern = fallback(*ld[3])
+
+    for ld in filter(lambda ld: ld[0] == 'value', lexdefs):
+        rule = LexRule('value', ld[1], len(rules) + 2, encode(_try_regex(ld[2], ld[3], wide)))
+        rules.append(rule)
+        try:
+            parts = split_capture(rule.regex) if rule.regex else None
+        except UnsupportedRegex:
+            rule.regex = None
+        if not rule.regex:
+            rule.pattern = fallback(ld[2], ld[3])
+            fallback_first(rule, ld[2], ld[3])
+        elif parts:
+            prefix, group, suffix = parts
+            name = f"_lexdfa_cap{len(rules) - 1}"
+            tables += emit_dfa(f"{name}_prefix", build_dfa([prefix], maxchar))
+            tables += emit_dfa(f"{name}_group_suffix", build_dfa([reverse_regex(('cat', (group, suffix)))], maxchar))
+            tables += emit_dfa(f"{name}_group", build_dfa([group], maxchar))
+            tables += emit_dfa(f"{name}_suffix", build_dfa([reverse_regex(suffix)], maxchar))
+            tables += f"static const DFACapture {name} = {{ &{name}_prefix, &{name}_group_suffix, &{name}_group, &{name}_suffix }};\n\n"
+            rule.capture = f"&{name}"
+
+    # skip scanners stand in for `std::regex` fallbacks, which they match exactly. They replace the lexer DFA
+    # for skipping only if they cover every skip, and no two skips can start with the same character.
+    skips = [r for r in rules if r.kind == 'skip']
+    first_chars = sorted(c for r in skips if r.shape for c in _first_chars(r.shape))
+    fast_skips = skips and all(r.shape for r in skips) and all(a[1] < b[0] for a, b in zip(first_chars, first_chars[1:]))
+    for i, r in enumerate(rules):
+        if r.kind == 'skip' and r.shape and (fast_skips or not r.regex):
+            r.scanner = f"&_lexskip{i}"
+            tables += emit_skip_scanner(f"_lexskip{i}", r.shape, i)
+
+    nothing = ('chars', ()) # placeholder for rules matched by `std::regex`
+    always_final = [i for i, r in enumerate(rules) if r.terminator == 'nullptr' and r.terminator_class == 'nullptr' and r.terminator_pattern < 0]
+    tables += emit_dfa("_lexdfa", build_dfa([r.regex or nothing for r in rules], maxchar, always_final))
+
+    tables += f"static const LexRule _lexer_rules[{max(len(rules), 1)}] = {{\n"
+    tables += "".join(f"    {r.cpp()}\n" for r in rules)
+    tables += "};\n\n"
+
+    init = TABBY + f"lexer.set_rules(&_lexdfa, _lexer_rules, {len(rules)});\n"
+    init += "".join(TABBY + f"lexer.add_pattern({p});\n" for p in patterns)
+    if fast_skips:
+        init += TABBY + "lexer.enable_fast_skips();\n"
+    return (tables, init)
+
+
+def compile_token_table(lexdefs: List[tuple], uni: bool) -> tuple:
+    '''
+    Compile the name and literal value of every token into a `TokenInfo` table indexed by
+    token code. Token codes are only known to the C++ compiler, so it fills in the table.
+
+    Returns the C++ table definition, and the `_init_lexer()` line registering it.
+    '''
+    cs = lambda s: cstring(escape_backslash(s), uni)
+    tokens = [ld for ld in lexdefs if ld[0] != 'skip']
+
+    tables = f"static constexpr size_t _lexer_token_count = static_cast<size_t>(std::max({{0{''.join(f', {ld[1]}' for ld in tokens)}}})) + 1;\n\n"
+    tables += "static constexpr std::array<TokenInfo, _lexer_token_count> _lexer_tokens = [] {\n"
+    tables += "    std::array<TokenInfo, _lexer_token_count> tokens {};\n"
+    for ld in tokens:
+        literal = cs(ld[2]) if ld[0] == 'literal' else 'nullptr'
+        tables += f"    tokens[{ld[1]}] = TokenInfo {{{cs(ld[1])}, {literal}}};\n"
+    tables += "    return tokens;\n}();\n\n"
+
+    init = TABBY + "lexer.set_tokens(_lexer_tokens.data(), _lexer_tokens.size());\n"
+    return (tables, init)
+
+
+def implement_lexdef_line(lexdef: tuple, uni: bool) -> str:
+    if lexdef[0] == 'string':
+        return TABBY + decode_stringdef(lexdef[1], lexdef[2])
+    return ''
+
 def lexer_report(lexdefs: List):
     '''
     Get the list of all defined tokens.
     '''
     return list(map(lambda ld: ld[1], lexdefs))
 
-def make_lexer(lemon_source: str, uni = False) -> str:
+def make_lexer(lemon_source: str, uni = False, utf8 = False) -> str:
     lexdefs = scan_lexer_def(lemon_source)
-    lexer_impl = LEXER_START + "\n".join(map(lambda ld: implement_lexdef_line(ld, uni), lexdefs)) + LEXER_END
+    tables, table_init = compile_lexer_tables(lexdefs, uni, utf8)
+    token_table, token_init = compile_token_table(lexdefs, uni)
+    lexer_impl = LEXER_TABLES_START + tables + token_table + LEXER_START + table_init + token_init + "".join(map(lambda ld: implement_lexdef_line(ld, uni), lexdefs)) + LEXER_END
     report = lexer_report(lexdefs)
     return (lexer_impl, report)
\ No newline at end of file
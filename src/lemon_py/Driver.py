@@ -32,10 +32,16 @@ class Driver:
         importlib.invalidate_caches()
         mod = importlib.import_module(lang_name)
         self._parse_fn = getattr(mod, 'parse')
+        self._parse_file_fn = getattr(mod, 'parse_file')
         self._dot_fn = getattr(mod, 'dotify')
+        self._flatten_fn = getattr(mod, 'flatten')
+        self._flat_tree_class = getattr(mod, 'FlatTree')
 
     def parse(self, instr: str):
         return self._parse_fn(instr)
+
+    def parse_file(self, infile_path: str):
+        return self._parse_file_fn(infile_path)
     
     def dotify(self, parse_tree) -> str:
         return self._dot_fn(parse_tree)
@@ -55,6 +61,12 @@ class Driver:
     def to_json(self, parse_tree) -> str:
         return json.dumps(parse_tree.as_dict(), indent=1)
 
+    def save(self, parse_tree, outfile_path):
+        self._flatten_fn(parse_tree).save(outfile_path)
+
+    def load(self, infile_path: str):
+        return self._flat_tree_class.load(infile_path)
+
 
 if __name__ == '__main__':
     import argparse
@@ -63,26 +75,26 @@ if __name__ == '__main__':
     ap.add_argument('--vis', default=False, const=True, action='store_const', help="Visualize with dot.")
     ap.add_argument('--dot', type=str, help="Dot output file.")
     ap.add_argument('--json', default=False, const=True, action='store_const', help="Dump a JSON representation of the tree to the console.")
+    ap.add_argument('--save', type=str, help="Save the tree to a binary file, which `FlatTree.load()` can read back.")
     ap.add_argument('language', type=str, help="Language module name to use.")
     ap.add_argument('input_file', type=str, help="Input file to parser. Specify `0` (zero) to accept input from stdin.")
     args = ap.parse_args()
 
     d = Driver(args.language)
 
-    infile = sys.stdin
     if args.input_file != '0':
-        infile = open(args.input_file, 'r')
-        
-    parse_tree = d.parse(infile.read())
-    
-    if args.input_file != '0':
-        infile.close()
+        parse_tree = d.parse_file(args.input_file)
+    else:
+        parse_tree = d.parse(sys.stdin.read())
     
     if args.dot:
         d.write_dot(parse_tree, args.dot)
     
     if args.json:
         print(d.to_json(parse_tree))
+
+    if args.save:
+        d.save(parse_tree, args.save)
     
     if args.vis:
         d.vis_dot(parse_tree)
\ No newline at end of file
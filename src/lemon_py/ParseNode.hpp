@@ -28,6 +28,11 @@ SOFTWARE.
 #include <sstream>
 #include <optional>
 #include <vector>
+#include <string_view>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
 
 #ifndef LEMON_PY_SUPPRESS_PYTHON
 #include <pybind11/pybind11.h>
@@ -35,12 +40,46 @@ SOFTWARE.
 #include <pybind11/operators.h>
 namespace py = pybind11;
 #else
-/** When python is suppressed, stubs out the `dict` definition used to hold parse node attributes. */
-namespace py { using dict = void*; }
+/** When python is suppressed, stubs out the `object` definition used to hold parse node attributes. */
+namespace py { using object = void*; }
 #endif
 
+namespace _parser_impl {
+struct ParseNode;
+}
+
 namespace parser {
 
+/**
+ * Get the name of a production or token symbol id. Token symbol ids are the token codes
+ * defined by Lemon, and production ids follow them.
+ * 
+ * @throw std::runtime_error if the id is out of range.
+*/
+std::string const& symbol_name(int32_t id);
+
+/** Is the given symbol id a token type? */
+bool symbol_is_terminal(int32_t id);
+
+/** Get the symbol id of a production name, or -1 if there's no such production. */
+int32_t production_id(std::string const& name);
+
+/** Get the symbol id of a token name, or -1 if there's no such token. */
+int32_t type_id(std::string const& name);
+
+/**
+ * Get the fingerprint of the grammar this parser was built from. It changes whenever the
+ * grammar, the lemon-py sources, or the text mode change the trees the parser would build.
+*/
+std::string const& grammar_fingerprint();
+
+/** Get the name of a symbol id, or nullopt for -1. */
+inline
+std::optional<std::string_view> symbol_name_or_null(int32_t id) {
+    if (id < 0) return std::nullopt;
+    return std::string_view(symbol_name(id));
+}
+
 #ifndef LEMON_PY_SUPPRESS_PYTHON
 /** Get a string value or None. */
 inline 
@@ -52,56 +91,137 @@ py::object string_or_none(std::optional<std::string> const& v) {
         return py::str(v.value());
     }
 }
+
+/** Get a symbol name or None. */
+inline 
+py::object symbol_name_or_none(int32_t id) {
+    if (id < 0) {
+        return py::none();
+    }
+    else {
+        return py::str(symbol_name(id));
+    }
+}
+
+/** Get a symbol id or None. */
+inline 
+py::object symbol_id_or_none(int32_t id) {
+    if (id < 0) {
+        return py::none();
+    }
+    else {
+        return py::int_(id);
+    }
+}
 #endif
 
 
+/**
+ * Append `in` to `out`, sanitized for dot. This is a single pass over the input.
+*/
+inline
+void sanitize_into(std::string & out, std::string_view in) {
+    size_t clean = 0; // start of the run of characters that don't need escaping
+    for (size_t i = 0; i < in.size(); i++) {
+        const char* replace;
+        switch (in[i]) {
+        case '&': replace = "&amp;"; break;
+        case '"': replace = "&quot;"; break;
+        //case '\'': replace = "&apos;"; break; // apparently dot doesn't care about this?
+        case '<': replace = "&lt;"; break;
+        case '>': replace = "&gt;"; break;
+        default: continue;
+        }
+        out.append(in, clean, i - clean);
+        out.append(replace);
+        clean = i + 1;
+    }
+    out.append(in, clean);
+}
+
 /**
  * Sanitize a string for dot.
 */
 inline 
-std::string sanitize(std::string in) {
-    auto clean = [&in] (char c, const char* replace, int skipForward = 0) {
-        size_t res = 0;
-        while((res = in.find(c, res)) < std::string::npos) {
-            in.erase(res, 1);
-            in.insert(res, replace);
-            res += skipForward;
-        }
-    };
+std::string sanitize(std::string_view in) {
+    std::string retval;
+    retval.reserve(in.size());
+    sanitize_into(retval, in);
+    return retval;
+}
 
-    clean('&', "&amp;", 1);
-    clean('"', "&quot;");
-    //clean('\'', "&apos;"); // apparently dot doesn't care about this?
-    clean('<', "&lt;");
-    clean('>', "&gt;");
-    //clean('\n', "<br>");
+/**
+ * Where a node came from in the input. Offsets count bytes from the start of the input (code
+ * points, in `--unicode` parsers). Lines and columns count from 1, and the end is exclusive.
+ * Every field is -1 if the position isn't known, as for a production with no children.
+ * 
+ * A token's span covers its whole match, including string delimiters. A production's span
+ * covers the spans of its children.
+*/
+struct SourceSpan {
+    int64_t begin = -1; ///< offset of the first byte
+    int64_t end = -1; ///< offset just past the last byte
+    int32_t beginLine = -1; ///< line of `begin`
+    int32_t beginColumn = -1; ///< column of `begin`
+    int32_t endLine = -1; ///< line of `end`
+    int32_t endColumn = -1; ///< column of `end`
 
-    return std::move(in);
-}
+    /** Is this a known position? */
+    bool known() const {
+        return begin >= 0;
+    }
+
+    /** Get the smallest span covering this one and `o`. Unknown spans are ignored. */
+    SourceSpan merge(SourceSpan const& o) const {
+        if (!o.known()) return *this;
+        if (!known()) return o;
+
+        SourceSpan retval = *this;
+        if (o.begin < begin) {
+            retval.begin = o.begin;
+            retval.beginLine = o.beginLine;
+            retval.beginColumn = o.beginColumn;
+        }
+        if (o.end > end) {
+            retval.end = o.end;
+            retval.endLine = o.endLine;
+            retval.endColumn = o.endColumn;
+        }
+        return retval;
+    }
+
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::tuple asTuple() const {
+        return py::make_tuple(begin, end, beginLine, beginColumn, endLine, endColumn);
+    }
+#endif
+};
 
 /**
  * A value-typed parse node (in contrast to the indirect, pointer-based parse tree used internally).
 */
 struct ParseNode {
-    std::optional<std::string> production; ///< the production name, if an internal node
-    std::optional<std::string> tokName; ///< the token name, if a terminal node
+    int32_t productionId; ///< the production symbol id if an internal node, otherwise -1
+    int32_t typeId; ///< the token symbol id if a terminal node, otherwise -1
     std::optional<std::string> value; ///< the token value, if a value token
     int64_t line; ///< line number for this node. -1 if unknown.
+    SourceSpan span; ///< the part of the input this node came from
     std::vector<ParseNode> children; ///< all the children of this parse node
     int id; ///< id number, unique within a single tree
-    py::dict attr; ///< if python is enabled, this is a dictionary to contain attributes added by a python transformer
+    mutable py::object attr; ///< if python is enabled, a dictionary for attributes added by a python transformer. Null until first used, see `getAttr()`.
 
-    ParseNode() : production(), tokName(), value(), line(-1), children(), id(-1), attr() {}
-    ParseNode(ParseNode && o) noexcept : production(std::move(o.production)), tokName(std::move(o.tokName)), value(std::move(o.value)), line(o.line), children(std::move(o.children)), id(o.id), attr(std::move(o.attr)) {
+    ParseNode() : productionId(-1), typeId(-1), value(), line(-1), span(), children(), id(-1), attr() {}
+    ParseNode(ParseNode && o) noexcept : productionId(o.productionId), typeId(o.typeId), value(std::move(o.value)), line(o.line), span(o.span), children(std::move(o.children)), id(o.id), attr(std::move(o.attr)) {
         o.id = -1;
     }
 
     ParseNode& operator=(ParseNode && o) noexcept {
         using namespace std;
-        production = move(o.production);
-        tokName = move(o.tokName);
+        productionId = o.productionId;
+        typeId = o.typeId;
         value = move(o.value);
         line = o.line;
+        span = o.span;
         children = move(o.children);
         id = o.id;
         o.id = -1;
@@ -113,10 +233,46 @@ struct ParseNode {
     ParseNode(ParseNode const& o ) = delete;
     ParseNode& operator=(ParseNode const& o) = delete;
 
+    /**
+     * Tear down the subtree without recursing, so that very deep trees don't overflow the stack.
+     * Internal descendants are moved onto a heap worklist, and each is destroyed once it holds
+     * only leaves.
+    */
+    ~ParseNode() {
+        if (children.empty()) return;
+
+        std::vector<ParseNode> pending = std::move(children);
+        while (!pending.empty()) {
+            ParseNode n = std::move(pending.back());
+            pending.pop_back();
+            for (auto & c : n.children) {
+                if (!c.children.empty()) pending.push_back(std::move(c));
+            }
+        }
+    }
+
+    /** Get the production name, if an internal node. */
+    std::optional<std::string_view> production() const {
+        return symbol_name_or_null(productionId);
+    }
+
+    /** Get the token name, if a terminal node. */
+    std::optional<std::string_view> tokName() const {
+        return symbol_name_or_null(typeId);
+    }
+
 #ifndef LEMON_PY_SUPPRESS_PYTHON
 
     py::object getProduction() const {
-        return string_or_none(production);
+        return symbol_name_or_none(productionId);
+    }
+
+    py::object getProductionId() const {
+        return symbol_id_or_none(productionId);
+    }
+
+    py::object getTypeId() const {
+        return symbol_id_or_none(typeId);
     }
 
     py::object getValue() const {
@@ -124,25 +280,52 @@ struct ParseNode {
     }
 
     py::object getToken() const {
-        return string_or_none(tokName);
+        return symbol_name_or_none(typeId);
     }
 
+    /** Get the attribute dictionary, creating it on first use. Most nodes never need one. */
+    py::dict getAttr() const {
+        if (!attr) attr = py::dict();
+        return py::reinterpret_borrow<py::dict>(attr);
+    }
+
+    /**
+     * Copy this subtree into nested dictionaries. This walks an explicit stack rather than
+     * recursing, so it works on arbitrarily deep trees.
+    */
     py::dict asDict() const {
-        py::dict myDict;
-        myDict["production"] = getProduction();
-        myDict["type"] = getToken();
-        myDict["value"] = getValue();
-        myDict["id"] = id;
-        myDict["line"] = line;
-        myDict["attr"] = attr;
-
-        auto childList = py::list();
-        for (auto const& c : *this) {
-            childList.append(c.asDict());
+        py::dict retval;
+        std::vector<std::pair<ParseNode const*, py::list>> stack; // node, and its parent's child list
+        stack.emplace_back(this, py::list());
+
+        while (!stack.empty()) {
+            auto [n, siblings] = std::move(stack.back());
+            stack.pop_back();
+
+            py::dict myDict;
+            myDict["production"] = n->getProduction();
+            myDict["type"] = n->getToken();
+            myDict["value"] = n->getValue();
+            myDict["id"] = n->id;
+            myDict["line"] = n->line;
+            myDict["span"] = n->span.asTuple();
+            myDict["attr"] = n->getAttr();
+
+            auto childList = py::list();
+            myDict["c"] = childList;
+            for (auto c = n->children.rbegin(); c != n->children.rend(); ++c) {
+                stack.emplace_back(&*c, childList); // reversed, so children are appended in order
+            }
+
+            if (n == this) {
+                retval = myDict;
+            }
+            else {
+                siblings.append(myDict);
+            }
         }
-        myDict["c"] = childList;
 
-        return myDict;
+        return retval;
     }
 
 #endif
@@ -152,11 +335,11 @@ struct ParseNode {
     */
     std::string toString() const {
         char outbuf[1024]; // just do the first 1k characters
-        if (production) {
-            snprintf(outbuf, 1024, "{%s} [%lu]", production.value().c_str(), children.size());
+        if (productionId >= 0) {
+            snprintf(outbuf, 1024, "{%s} [%lu]", symbol_name(productionId).c_str(), children.size());
         }
         else {
-            snprintf(outbuf, 1024, "%s <%s>", tokName.value().c_str(), value.value().c_str());
+            snprintf(outbuf, 1024, "%s <%s>", symbol_name(typeId).c_str(), value.value().c_str());
         }
 
         return std::string(outbuf);
@@ -165,26 +348,7 @@ struct ParseNode {
     /**
      * Add this node and its children to the dot graph being built up in `out`.
     */
-    void dotify(std::stringstream & out, const ParseNode * parent) const {
-        char buf[1024];
-
-        if (production) {
-            snprintf(buf, 1024, "node [shape=record, label=\"{<f0>line:%ld | <f1> %s }\"] %d;\n", line, sanitize(production.value()).c_str(), id);
-        }
-        else {
-            snprintf(buf, 1024, "node [shape=record, label=\"{<f0>line:%ld | { <f1> %s | <f2> %s}}\"] %d;\n", line, sanitize(tokName.value()).c_str(), sanitize(value.value()).c_str(), id);
-        }
-        out << buf;
-
-        if (parent) {
-            snprintf(buf, 1024, "%d -> %d;\n", parent->id, id);
-            out << buf;
-        }
-
-        for (auto const& c : children) {
-            c.dotify(out, this);
-        }
-    }
+    void dotify(std::stringstream & out, const ParseNode * parent) const;
 
     /**
      * Get a particular child node.
@@ -224,18 +388,25 @@ struct ParseNode {
      * productions, token name, and value are identical; as well
      * as all their children being equal under this same definition.
      * 
-     * This check is recursive.
+     * This compares whole subtrees, walking an explicit stack rather than recursing.
     */
     bool operator==(ParseNode const& o) const {
-        if (&o == this) return true; // we're always equal to ourselves.
+        std::vector<std::pair<ParseNode const*, ParseNode const*>> stack { {this, &o} };
+
+        while (!stack.empty()) {
+            auto [a, b] = stack.back();
+            stack.pop_back();
 
-        if (childCount() != o.childCount()) return false; // order these checks from cheapest to most expensive
-        if (tokName != o.tokName) return false;
-        if (production != o.production) return false;
-        if (value != o.value) return false;
+            if (a == b) continue; // we're always equal to ourselves.
 
-        for (auto myC = begin(), oC = o.begin(); myC != end() && oC != o.end(); ++myC, ++oC) {
-            if (*myC != *oC) return false;
+            if (a->childCount() != b->childCount()) return false; // order these checks from cheapest to most expensive
+            if (a->typeId != b->typeId) return false;
+            if (a->productionId != b->productionId) return false;
+            if (a->value != b->value) return false;
+
+            for (size_t i = 0; i < a->children.size(); i++) {
+                stack.emplace_back(&a->children[i], &b->children[i]);
+            }
         }
 
         return true;
@@ -247,6 +418,290 @@ struct ParseNode {
 
 };
 
+/**
+ * A single node of a `FlatTree`.
+ * 
+ * Nodes are stored in pre-order, so the first child of a node (if any) immediately follows it,
+ * and its next sibling follows its entire subtree.
+*/
+struct FlatNode {
+    uint64_t valueOffset; ///< offset of the token value in the tree's string pool, if a terminal node
+    int64_t line; ///< line number for this node. -1 if unknown.
+    uint32_t symbol; ///< production or token symbol id, see `symbol_name()`
+    uint32_t valueLength; ///< length of the token value, if a terminal node
+    uint32_t childCount; ///< number of direct children
+    uint32_t subtreeSize; ///< number of nodes in this subtree, including this one
+    SourceSpan span; ///< the part of the input this node came from
+};
+
+class FlatTree;
+
+/**
+ * A lightweight handle to a node in a `FlatTree`. The tree must outlive the handle.
+*/
+class FlatNodeRef {
+    FlatTree const* tree; ///< tree holding the node
+    uint32_t index; ///< index of the node in the tree
+
+    FlatNode const& node() const;
+
+public:
+    FlatNodeRef(FlatTree const* tree, uint32_t index) : tree(tree), index(index) {}
+
+    /** Iterates over the direct children of a node, hopping from sibling to sibling. */
+    class iterator {
+        FlatTree const* tree;
+        uint32_t index;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FlatNodeRef;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = FlatNodeRef;
+
+        iterator(FlatTree const* tree, uint32_t index) : tree(tree), index(index) {}
+
+        FlatNodeRef operator*() const { return FlatNodeRef(tree, index); }
+        iterator& operator++();
+        iterator operator++(int) { auto retval = *this; ++(*this); return retval; }
+        bool operator==(iterator const& o) const { return index == o.index; }
+        bool operator!=(iterator const& o) const { return index != o.index; }
+    };
+
+    /** Is this a terminal (token) node? */
+    bool isTerminal() const;
+
+    /** Get the production or token symbol id. */
+    int32_t symbol() const { return static_cast<int32_t>(node().symbol); }
+
+    /** Get the production name, if an internal node. */
+    std::optional<std::string_view> production() const;
+
+    /** Get the token name, if a terminal node. */
+    std::optional<std::string_view> tokName() const;
+
+    /** Get the token value, if a terminal node. */
+    std::optional<std::string_view> value() const;
+
+    /** Get the line number for this node. -1 if unknown. */
+    int64_t line() const { return node().line; }
+
+    /** Get the part of the input this node came from. */
+    SourceSpan const& span() const { return node().span; }
+
+    /** Get the pre-order index of this node, which is unique within the tree. */
+    uint32_t id() const { return index; }
+
+    /** Number of children of this node. */
+    size_t childCount() const { return node().childCount; }
+
+    /** Number of nodes in the subtree rooted at this node, including this one. */
+    size_t subtreeSize() const { return node().subtreeSize; }
+
+    /** Get an iterator to the first child. */
+    iterator begin() const { return iterator(tree, index + 1); }
+
+    /** Get the end of the children. */
+    iterator end() const { return iterator(tree, index + node().subtreeSize); }
+
+    /**
+     * Get a particular child node. This walks the preceding siblings, so iterate if you
+     * want all of them.
+    */
+    FlatNodeRef operator[](size_t childIndex) const {
+        if (childIndex >= childCount()) {
+            throw std::runtime_error("Child index out of range.");
+        }
+        auto it = begin();
+        while (childIndex--) ++it;
+        return *it;
+    }
+};
+
+/**
+ * A read-only view of a contiguous array, like C++20's `std::span`.
+*/
+template <typename T>
+class ArrayView {
+    T const* first; ///< the first element
+    size_t count; ///< number of elements
+
+public:
+    ArrayView() : first(nullptr), count(0) {}
+    ArrayView(T const* first, size_t count) : first(first), count(count) {}
+
+    T const& operator[](size_t index) const { return first[index]; }
+    T const* data() const { return first; }
+    T const* begin() const { return first; }
+    T const* end() const { return first + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+/**
+ * A compact parse tree held in a single contiguous array of nodes, in pre-order, with token
+ * values in one shared string pool.
+ * 
+ * Walking the whole tree is a linear scan of `nodes`. The arrays are immutable and shared,
+ * so copying a `FlatTree` is cheap. They're either built in memory by a parse, or mapped
+ * straight from a file written by `save()`.
+*/
+class FlatTree {
+public:
+    ArrayView<FlatNode> nodes; ///< every node, in pre-order, with the root first
+    std::string_view pool; ///< token values, referenced by `FlatNode::valueOffset`
+    std::shared_ptr<void const> storage; ///< keeps `nodes` and `pool` alive
+
+    /** Get the root node. */
+    FlatNodeRef root() const {
+        if (nodes.empty()) {
+            throw std::runtime_error("Tree is empty.");
+        }
+        return FlatNodeRef(this, 0);
+    }
+
+    /** Get a node by its pre-order index. */
+    FlatNodeRef operator[](size_t index) const {
+        if (index >= nodes.size()) {
+            throw std::runtime_error("Node index out of range.");
+        }
+        return FlatNodeRef(this, static_cast<uint32_t>(index));
+    }
+
+    /** Number of nodes in the tree. */
+    size_t size() const {
+        return nodes.size();
+    }
+
+    /**
+     * Save the tree to a binary file that `load()` can map back in. The file holds the node
+     * table, the string pool, and the names of the symbols it uses.
+     * 
+     * @throw std::runtime_error if the file cannot be written.
+    */
+    void save(std::string const& path) const;
+
+    /**
+     * Load a tree written by `save()`. The file is mapped rather than read, and nodes are
+     * served straight out of the mapping, so loading takes the same time for any size of tree
+     * and only the pages holding visited nodes are read in.
+     * 
+     * Symbols are matched up by name. If any saved symbol id differs from this parser's (as
+     * can happen with production names made up at runtime), the node table is copied with the
+     * ids translated instead. The file is otherwise trusted to be one that `save()` wrote.
+     * 
+     * @throw std::runtime_error if the file cannot be read, isn't a saved tree, or uses a
+     * token this grammar doesn't have.
+    */
+    static FlatTree load(std::string const& path);
+};
+
+inline FlatNode const& FlatNodeRef::node() const {
+    return tree->nodes[index];
+}
+
+inline FlatNodeRef::iterator& FlatNodeRef::iterator::operator++() {
+    index += tree->nodes[index].subtreeSize;
+    return *this;
+}
+
+inline bool FlatNodeRef::isTerminal() const {
+    return symbol_is_terminal(symbol());
+}
+
+inline std::optional<std::string_view> FlatNodeRef::production() const {
+    if (isTerminal()) return std::nullopt;
+    return std::string_view(symbol_name(symbol()));
+}
+
+inline std::optional<std::string_view> FlatNodeRef::tokName() const {
+    if (!isTerminal()) return std::nullopt;
+    return std::string_view(symbol_name(symbol()));
+}
+
+inline std::optional<std::string_view> FlatNodeRef::value() const {
+    if (!isTerminal()) return std::nullopt;
+    return std::string_view(tree->pool).substr(node().valueOffset, node().valueLength);
+}
+
+struct LazyTree;
+
+/**
+ * A handle to a node of a finished parse that's still in the parser's internal form. Nothing
+ * is converted until it's asked for: names, values, and spans are made on each call, and
+ * children are handed out as more handles. Handles keep their tree alive.
+*/
+class LazyNodeRef {
+    std::shared_ptr<LazyTree const> tree; ///< tree holding the node
+    _parser_impl::ParseNode const* node; ///< the internal node
+
+public:
+    LazyNodeRef(std::shared_ptr<LazyTree const> tree, _parser_impl::ParseNode const* node) : tree(std::move(tree)), node(node) {}
+
+    /** Is this a terminal (token) node? */
+    bool isTerminal() const;
+
+    /** Get the production or token symbol id. */
+    int32_t symbol() const;
+
+    /** Get the production name, if an internal node. */
+    std::optional<std::string_view> production() const;
+
+    /** Get the token name, if a terminal node. */
+    std::optional<std::string_view> tokName() const;
+
+    /** Get the token value, if a terminal node. */
+    std::optional<std::string> value() const;
+
+    /** Get the line number for this node. -1 if unknown. */
+    int64_t line() const;
+
+    /** Get the part of the input this node came from. A production's span visits its whole subtree. */
+    SourceSpan span() const;
+
+    /** Get an id for this node, unique within the tree. Ids are handed out as nodes are first asked for one. */
+    int id() const;
+
+    /** Number of children of this node. */
+    size_t childCount() const;
+
+    /** Get a particular child node. */
+    LazyNodeRef operator[](size_t index) const;
+
+    /** Get handles to all the children. */
+    std::vector<LazyNodeRef> children() const;
+
+    /** Convert this node and its whole subtree to a value-typed `ParseNode`. */
+    ParseNode uplift() const;
+
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    /** Get this node's attribute dictionary, creating it on first use. */
+    py::dict attr() const;
+
+    py::object getProduction() const {
+        return symbol_name_or_none(isTerminal() ? -1 : symbol());
+    }
+
+    py::object getToken() const {
+        return symbol_name_or_none(isTerminal() ? symbol() : -1);
+    }
+
+    py::object getValue() const {
+        return string_or_none(value());
+    }
+
+    py::dict asDict() const;
+#endif
+
+    /** Checks for syntactic equality, just like `ParseNode::operator==`. */
+    bool operator==(LazyNodeRef const& o) const;
+
+    bool operator!=(LazyNodeRef const& o) const {
+        return !(*this == o);
+    }
+};
+
 /**
  * Parse a string and return a parse tree.
  * 
@@ -254,9 +709,447 @@ struct ParseNode {
 */
 ParseNode parse_string(std::string const& input);
 
+/**
+ * Parse a buffer in place, without copying it, and return a parse tree.
+ * 
+ * @throw std::runtime_error if there is a lex or parse error.
+*/
+ParseNode parse_buffer(const char* data, size_t length);
+
+/**
+ * Memory-map a file and parse it in place, returning a parse tree.
+ * 
+ * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+*/
+ParseNode parse_file(std::string const& path);
+
+/**
+ * Parse a string and return a flat parse tree.
+ * 
+ * @throw std::runtime_error if there is a lex or parse error.
+*/
+FlatTree parse_flat(std::string const& input);
+
+/**
+ * Memory-map a file and parse it in place, returning a flat parse tree.
+ * 
+ * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+*/
+FlatTree parse_flat_file(std::string const& path);
+
+/**
+ * Convert a value-typed parse tree into a flat one, for instance to `save()` it.
+*/
+FlatTree flatten(ParseNode const& root);
+
+/**
+ * Parse a string into a tree that's converted lazily, returning a handle to the root.
+ * 
+ * @throw std::runtime_error if there is a lex or parse error.
+*/
+LazyNodeRef parse_lazy(std::string input);
+
+/**
+ * Memory-map a file and parse it in place into a tree that's converted lazily, returning a
+ * handle to the root. The file stays mapped as long as any handle is alive.
+ * 
+ * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+*/
+LazyNodeRef parse_lazy_file(std::string const& path);
+
+/**
+ * Counters for the last `Document::edit()`, to see how much of the previous parse it reused.
+*/
+struct DocumentEditStats {
+    size_t relexedTokens = 0; ///< tokens lexed again around the edit
+    size_t reusedSubtrees = 0; ///< subtrees of the previous parse pushed whole
+    size_t reusedTokens = 0; ///< tokens covered by those subtrees
+    size_t parsedTokens = 0; ///< tokens parsed one at a time
+    bool fullParse = false; ///< was the whole text parsed from scratch?
+};
+
+/**
+ * A text that's kept parsed while it's edited, as in an editor.
+ * 
+ * Each edit relexes only the tokens around it, starting from the last token boundary the edit
+ * can't have moved and stopping once the lexer is back in step with the old tokens. The
+ * reparse then pushes whole subtrees of the previous parse wherever it reaches their tokens in
+ * the parser state they were parsed in, so most of the work done is in proportion to the edit,
+ * not the text. Every so often, once enough reparses have piled up, the text is parsed from
+ * scratch to free the nodes they've left behind.
+ * 
+ * Trees are handed out as `LazyNodeRef`s. Reused nodes are shared with earlier trees, and are
+ * updated in place, so a handle taken before an edit may find its node's children or spans
+ * changed by it. Get the `root()` again after each edit. Handles are always safe to use, but a
+ * document (and its handles) must only be used by one thread at a time.
+*/
+class Document {
+    struct Impl;
+    std::unique_ptr<Impl> impl; ///< text, tokens, and parse state
+
+public:
+    /**
+     * Parse the given text.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    explicit Document(std::string text);
+    Document(Document &&) noexcept;
+    Document& operator=(Document &&) noexcept;
+    ~Document();
+
+    /**
+     * Replace the text from `begin` to `end` with `replacement`, and reparse it, returning the
+     * new root. Offsets are in the same units as `SourceSpan`s.
+     * 
+     * @throw std::runtime_error if the range is out of bounds, or the edited text has a lex or
+     * parse error. The edit is kept even then, but the `root()` stays the last tree that
+     * parsed, and the next edit reparses everything changed since.
+    */
+    LazyNodeRef edit(size_t begin, size_t end, std::string_view replacement);
+
+    /** Get the root of the last tree that parsed. */
+    LazyNodeRef root() const;
+
+    /** Get the current text. */
+    std::string text() const;
+
+    /** Get the counters for the last edit. */
+    DocumentEditStats lastEditStats() const;
+};
+
+/**
+ * One input to `parse_batch()`: either text to parse, or the path of a file to memory-map and
+ * parse. The referenced data must outlive the call.
+*/
+struct BatchInput {
+    std::string_view data; ///< the input text, or a file path
+    bool isFile = false; ///< is `data` a file path?
+};
+
+/**
+ * The outcome of parsing one input of a batch: a parse tree, or the error message.
+*/
+struct BatchResult {
+    std::optional<ParseNode> tree; ///< the parse tree, if the parse succeeded
+    std::string error; ///< the error message, if the parse failed
+
+    /** Did the parse succeed? */
+    bool ok() const {
+        return tree.has_value();
+    }
+};
+
+/**
+ * Parse many inputs in parallel, returning one result per input, in input order.
+ * 
+ * The inputs are shared out over `threads` worker threads (one per core if 0), each with its
+ * own reusable parser. A worker that runs out of inputs steals half of another worker's
+ * remaining share. Lex, parse, and file errors are reported in each input's result instead of
+ * being thrown.
+*/
+std::vector<BatchResult> parse_batch(std::vector<BatchInput> const& inputs, size_t threads = 0);
+
+/**
+ * Parse many strings in parallel. See `parse_batch()`.
+*/
+std::vector<BatchResult> parse_batch(std::vector<std::string> const& inputs, size_t threads = 0);
+
+/**
+ * A reusable parser. The internal parser state, node storage, and string table
+ * capacity are kept from one parse to the next, so there's almost no setup cost
+ * for each parse.
+ * 
+ * A context can only run one parse at a time. Use one per thread, or a `ParserPool`.
+*/
+class ParserContext {
+    struct Impl;
+    std::unique_ptr<Impl> impl; ///< parser state
+
+public:
+    ParserContext();
+    ParserContext(ParserContext &&) noexcept;
+    ParserContext& operator=(ParserContext &&) noexcept;
+    ~ParserContext();
+
+    /**
+     * Parse a string and return a parse tree.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    ParseNode parse(std::string const& input);
+
+    /**
+     * Parse a buffer in place, without copying it, and return a parse tree.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    ParseNode parseBuffer(const char* data, size_t length);
+
+    /**
+     * Memory-map a file and parse it in place, returning a parse tree.
+     * 
+     * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+    */
+    ParseNode parseFile(std::string const& path);
+
+    /**
+     * Parse a string and return a flat parse tree.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    FlatTree parseFlat(std::string const& input);
+};
+
+/**
+ * A thread-safe pool of `ParserContext`s. Threads borrow a context for each parse, and
+ * new contexts are created whenever none are idle.
+*/
+class ParserPool {
+    std::mutex mutex; ///< guards `idle`
+    std::vector<std::unique_ptr<ParserContext>> idle; ///< contexts not currently in use
+
+public:
+    /** A context borrowed from a pool. It's returned to the pool when the lease is destroyed. */
+    class Lease {
+        ParserPool* pool; ///< pool to return the context to
+        std::unique_ptr<ParserContext> context; ///< the borrowed context
+
+    public:
+        Lease(ParserPool* pool, std::unique_ptr<ParserContext> context) : pool(pool), context(std::move(context)) {}
+        Lease(Lease &&) noexcept = default;
+        Lease& operator=(Lease &&) = delete;
+
+        ~Lease() {
+            if (context) pool->release(std::move(context));
+        }
+
+        ParserContext& operator*() const { return *context; }
+        ParserContext* operator->() const { return context.get(); }
+    };
+
+    /** Borrow a context, creating one if none are idle. */
+    Lease acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!idle.empty()) {
+                auto context = std::move(idle.back());
+                idle.pop_back();
+                return Lease(this, std::move(context));
+            }
+        }
+        return Lease(this, std::make_unique<ParserContext>());
+    }
+
+    /** Return a context to the pool. */
+    void release(std::unique_ptr<ParserContext> context) {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(std::move(context));
+    }
+
+    /** Number of contexts waiting to be borrowed. */
+    size_t idleCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return idle.size();
+    }
+
+    /** Parse a string with a borrowed context. */
+    ParseNode parse(std::string const& input) {
+        return acquire()->parse(input);
+    }
+
+    /** Parse a buffer in place with a borrowed context. */
+    ParseNode parseBuffer(const char* data, size_t length) {
+        return acquire()->parseBuffer(data, length);
+    }
+
+    /** Memory-map and parse a file with a borrowed context. */
+    ParseNode parseFile(std::string const& path) {
+        return acquire()->parseFile(path);
+    }
+
+    /** Parse a string into a flat tree with a borrowed context. */
+    FlatTree parseFlat(std::string const& input) {
+        return acquire()->parseFlat(input);
+    }
+};
+
+/**
+ * Parses input pushed in chunks, such as from a pipe or socket.
+ * 
+ * Tokens are lexed and parsed as soon as they're complete, so only the input following the
+ * last complete token is buffered. Tokens, strings, and skips may be split across chunks.
+ * A lexdef pattern that falls back to `std::regex` and could match a line break, or uses `$` or
+ * a backreference, is the exception: wherever it could start, the rest of the input is buffered
+ * until `finish()`, since its match could reach the end.
+*/
+class IncrementalParser {
+    struct Impl;
+    std::unique_ptr<Impl> impl; ///< parser state
+
+public:
+    /**
+     * Create a parser. Token values are copied out of each chunk, and with `internValues`
+     * set, equal values share one copy. That saves memory on inputs with many repeated
+     * identifiers, at the cost of hashing every value.
+    */
+    explicit IncrementalParser(bool internValues = false);
+    IncrementalParser(IncrementalParser &&) noexcept;
+    IncrementalParser& operator=(IncrementalParser &&) noexcept;
+    ~IncrementalParser();
+
+    /**
+     * Add the next chunk of input. Starts a new parse if one isn't in progress.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error, which also abandons the parse.
+    */
+    void feed(std::string_view chunk);
+
+    /**
+     * Finish the parse and return the parse tree. The next `feed()` starts a new parse.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    ParseNode finish();
+
+    /**
+     * Finish the parse and return a flat parse tree. The next `feed()` starts a new parse.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    FlatTree finishFlat();
+};
+
+/**
+ * Counters for a `ParseCache`, to help size it.
+*/
+struct ParseCacheStats {
+    uint64_t hits = 0; ///< parses answered from memory
+    uint64_t diskHits = 0; ///< parses answered by loading a tree from the cache directory
+    uint64_t misses = 0; ///< parses that had to lex and parse the input
+    uint64_t evictions = 0; ///< trees dropped from memory to stay under the size limit
+    size_t entries = 0; ///< trees held in memory
+    size_t bytes = 0; ///< size of the trees held in memory
+};
+
+/**
+ * An opt-in cache of parse results for inputs that are parsed over and over. Results are
+ * keyed on a 128-bit hash of the input bytes and the `grammar_fingerprint()`, and a repeated
+ * input gets its earlier tree back without running the lexer or parser.
+ * 
+ * Trees are kept as `FlatTree`s, least recently used first out once they take up more than
+ * `maxBytes`. Given a directory, every new tree is also saved there with `FlatTree::save()`,
+ * so later runs can map it back in rather than parsing again. The directory can be shared
+ * between grammars. Any problem reading or writing it just counts as a miss.
+ * 
+ * A cache can be used from many threads at once.
+*/
+class ParseCache {
+    struct Impl;
+    std::unique_ptr<Impl> impl; ///< cache state
+
+public:
+    /**
+     * Create a cache holding up to `maxBytes` of trees in memory, and saving them to `directory`
+     * too if it isn't empty. The directory is created if needed.
+     * 
+     * @throw std::runtime_error if the directory cannot be created.
+    */
+    explicit ParseCache(size_t maxBytes = 256 << 20, std::string const& directory = "");
+    ParseCache(ParseCache &&) noexcept;
+    ParseCache& operator=(ParseCache &&) noexcept;
+    ~ParseCache();
+
+    /**
+     * Parse a string, or get its tree from the cache.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error. Errors aren't cached.
+    */
+    ParseNode parse(std::string const& input);
+
+    /**
+     * Parse a buffer in place, or get its tree from the cache.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    ParseNode parseBuffer(const char* data, size_t length);
+
+    /**
+     * Memory-map a file and parse it in place, or get its tree from the cache. Files are keyed
+     * on their contents, not their paths.
+     * 
+     * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+    */
+    ParseNode parseFile(std::string const& path);
+
+    /**
+     * Like `parse()`, but returns the cached flat tree itself, which costs nothing to copy.
+     * 
+     * @throw std::runtime_error if there is a lex or parse error.
+    */
+    FlatTree parseFlat(std::string const& input);
+
+    /**
+     * Like `parseFile()`, but returns the cached flat tree itself.
+     * 
+     * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+    */
+    FlatTree parseFlatFile(std::string const& path);
+
+    /** Get the hit, miss, and size counters. */
+    ParseCacheStats stats() const;
+
+    /** Drop every tree held in memory. Saved trees stay in the directory. */
+    void clear();
+};
+
+/**
+ * Attempt, hit, and time counters for one part of the lexer.
+*/
+struct ProfileCounter {
+    std::string name; ///< lexdef name, or lexer step name
+    uint64_t attempts = 0; ///< times it was tried
+    uint64_t hits = 0; ///< times it matched, or made a token
+    uint64_t nanoseconds = 0; ///< time spent in it
+};
+
+/**
+ * Counters compiled into a parser built with `lempy_build --profile`, summed over every parse
+ * in the process since the last `reset_profile_stats()`.
+ * 
+ * Skips, literals, and values are all matched together by the lexer DFA, so a rule's attempts
+ * are the times the DFA reached a match for it, plus every run of its `std::regex` if the DFA
+ * couldn't compile it. A rule's time is the time to find the matches it won, plus the time in
+ * its `std::regex`, plus the time to make its tokens.
+*/
+struct ProfileStats {
+    bool enabled = false; ///< was the parser built with `--profile`? Everything else is empty if not.
+    std::vector<ProfileCounter> steps; ///< the lexer's `next`, `skip`, `string`, `scan`, `literal`, and `value` steps
+    std::vector<ProfileCounter> skips; ///< each skip pattern
+    std::vector<ProfileCounter> literals; ///< each literal
+    std::vector<ProfileCounter> values; ///< each value pattern
+    std::vector<ProfileCounter> strings; ///< each string definition
+    std::vector<std::pair<std::string, uint64_t>> reductions; ///< each grammar rule, and the times it was reduced
+    uint64_t shifts = 0; ///< tokens shifted by the parser
+};
+
+/** Get the profiling counters. Only a parser built with `--profile` has any. */
+ProfileStats profile_stats();
+
+/** Zero the profiling counters. */
+void reset_profile_stats();
+
 /**
  * Create a complete dot graph, rooted at the given ParseNode.
 */
 std::string dotify(ParseNode const& pn);
 
+/**
+ * Write a complete dot graph, rooted at the given ParseNode, to a file. The graph is streamed
+ * out through a small buffer rather than built up in memory.
+ * 
+ * @throw std::runtime_error if the file cannot be written.
+*/
+void dotify_file(ParseNode const& pn, std::string const& path);
+
 } // namespace parser
\ No newline at end of file
@@ -23,13 +23,59 @@ SOFTWARE.
 */
 
 #include <memory>
+#include <array>
 #include <variant>
+#include <optional>
 #include <cstdint>
+#include <cassert>
+#include <limits>
+#include <type_traits>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <list>
+#include <algorithm>
 #include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
 #include <iostream>
 #include <regex>
 #include <tuple>
 #include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <system_error>
+#include <charconv>
+#include <filesystem>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LEMON_PY_MMAP_SUPPORT
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// SIMD skip scanning. Define LEMON_PY_NO_SIMD to use only the portable scanners.
+#if !defined(LEMON_PY_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define LEMON_PY_SSE2
+#include <emmintrin.h>
+#endif
+
+#if !defined(LEMON_PY_NO_SIMD) && defined(__AVX2__)
+#define LEMON_PY_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // Forward declarations of types needed for Lemon function forward declarations
 // it's turtles all the way down when you've got no headers lol
@@ -46,6 +92,16 @@ void* LemonPyParseAlloc(void *(*mallocProc)(size_t));
 void LemonPyParseFree(void *p, void (*freeProc)(void*));
 void LemonPyParse(void *, int, _parser_impl::Token, _parser_impl::GrammarActionParserHandle);
 void LemonPyParseInit(void *);
+void LemonPyParseFinalize(void *);
+int LemonPyParseReduce(void *, int, _parser_impl::Token, _parser_impl::GrammarActionParserHandle);
+int LemonPyParseGoto(void *, int, const void *, size_t);
+const char* LemonPyParseRuleName(int);
+
+// Lemon calls these after every shift and reduction (see lempar.c), so that a `Document` can
+// log which subtrees it might reuse after an edit, and a `--profile` build can count them.
+// `yyRuleInfoNRhs` is Lemon's table of (negated) rule lengths.
+#define yyShiftHook(P) ((P)->_.shifted((P)->yytos - (P)->yystack), _parser_impl::profile_shift((P)->yytos->major < YYNTOKEN))
+#define yyReduceHook(P, R) ((P)->_.reduced((P)->yytos - (P)->yystack, yyRuleInfoNRhs[R] == 0, (P)->yytos->major, (P)->yytos[-1].stateno, &(P)->yytos->minor), _parser_impl::profile_reduce(R))
 
 
 #ifndef LEMON_PY_SUPPRESS_PYTHON
@@ -78,6 +134,11 @@ std::string const& toExternal(_parser_impl::ustring const& ascii) {
     return ascii;
 }
 
+inline
+std::string toExternal(_parser_impl::ustring_view ascii) {
+    return std::string(ascii);
+}
+
 inline
 _parser_impl::ustring const& toInternal(std::string const& ascii) {
     return ascii;
@@ -93,6 +154,13 @@ std::string toExternal(_parser_impl::ustring const& utf32) {
     return utf8::utf32to8(utf32);
 }
 
+inline
+std::string toExternal(_parser_impl::ustring_view utf32) {
+    std::string retval;
+    utf8::utf32to8(utf32.begin(), utf32.end(), std::back_inserter(retval));
+    return retval;
+}
+
 inline
 _parser_impl::ustring toInternal(std::string const& utf8) {
     return utf8::utf8toW(utf8);
@@ -100,65 +168,194 @@ _parser_impl::ustring toInternal(std::string const& utf8) {
 #endif
 
 using sstream = std::basic_stringstream<ustring::value_type>;
-using siter = ustring::const_iterator;
+using siter = ustring_view::const_iterator;
 using uregex = std::basic_regex<ustring::value_type>;
 using regex_results = std::match_results<siter>;
 using uuchar = ustring::value_type;
 
+#if defined(LEMON_PY_UNICODE_SUPPORT) || defined(LEMON_PY_UTF8_SUPPORT)
+/** Get the length of the longest prefix of `bytes` that doesn't end inside a UTF-8 sequence. */
+inline
+size_t completeUtf8Prefix(std::string_view bytes) {
+    size_t length = bytes.size();
+    for (size_t back = 1; back <= 4 && back <= length; back++) {
+        auto c = static_cast<unsigned char>(bytes[length - back]);
+        if ((c & 0xC0) == 0x80) continue; // continuation byte, keep looking for the lead
+
+        size_t sequenceLength = (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+        return sequenceLength > back ? length - back : length;
+    }
+    return length;
+}
+#endif
+
+#ifdef LEMON_PY_UTF8_SUPPORT
+/**
+ * Make sure the input is valid UTF-8. The lexer tables only match whole, valid sequences, and
+ * skips and terminators look at one byte at a time assuming they're part of one.
+ * 
+ * @throw std::runtime_error if it isn't.
+*/
+inline
+void checkUtf8(std::string_view bytes) {
+    auto invalid = utf8::find_invalid(bytes.begin(), bytes.end());
+    if (invalid != bytes.end()) {
+        throw std::runtime_error("Invalid UTF-8 in input at byte " + std::to_string(invalid - bytes.begin()) + ".");
+    }
+}
+#endif
+
 //==================== TOKENS ==============================
 
-/** Used to intern strings found by the lexer. */
+/** 
+ * Storage for token values that can't refer back into the input, such as joined strings
+ * and values lexed from a window of a stream.
+ * 
+ * Each value is copied by default. With interning on, equal values share a single copy,
+ * which is worth the hashing when many tokens repeat the same few values.
+*/
 class StringTable {
 protected:
-	std::vector<ustring> strings;
-
-	typedef std::unordered_map<ustring, size_t> LocationMap;
-
-	LocationMap cachedLocations;
+    std::deque<ustring> ownedStrings; ///< storage for copied strings, never reallocated
+    std::unordered_map<ustring_view, ustring_view> internedStrings; ///< copies by value, when `interning`
+    bool interning = false; ///< should equal strings share a copy?
 
 public:
 
-    /** Clear table state. */
+    /** Clear table state. Interning stays as it was. */
     void clear() {
-        cachedLocations.clear();
-        strings.clear();
+        internedStrings.clear();
+        ownedStrings.clear();
+    }
+
+    /** Turn interning of stored strings on or off. */
+    void setInterning(bool on) {
+        interning = on;
+        if (!on) internedStrings.clear();
     }
 
     /**
-     * Push a string and return the index.
+     * Store a copy of a string, returning a view of the copy. The view is valid until
+     * the table is cleared.
     */
-	size_t pushString(ustring const& s) {
-        auto it = cachedLocations.find(s);
-        if (it != cachedLocations.end()){
-            return (*it).second;
+    ustring_view store(ustring_view s) {
+        if (interning) {
+            auto it = internedStrings.find(s);
+            if (it != internedStrings.end()) return it->second;
+        }
+
+        ustring_view retval = ownedStrings.emplace_back(s);
+        if (interning) internedStrings.emplace(retval, retval);
+        return retval;
+    }
+};
+
+/**
+ * Module-wide table of symbol ids for token types and production names.
+ * 
+ * A token type's symbol id is its Lemon token code. Production ids follow the highest token
+ * code, starting with the production names found in the grammar actions at build time, so
+ * those ids are the same in every run of a given grammar. Productions named any other way
+ * get new ids as they're first seen.
+*/
+class SymbolTable {
+    std::deque<std::string> names; ///< external names by symbol id, empty for unused token codes
+    std::unordered_map<std::string_view, int32_t> productionIds; ///< production symbol ids by name
+    std::unordered_map<std::string_view, int32_t> typeIds; ///< token symbol ids by name
+    std::unordered_map<const char*, int32_t> literalIds; ///< production symbol ids by the addresses in `_production_names`
+    int32_t tokenCount = 0; ///< one more than the highest token code
+    mutable std::shared_mutex mutex; ///< guards additions of runtime production names
+
+    SymbolTable();
+
+public:
+    /** Get the module's symbol table, building it on first use. */
+    static SymbolTable& get();
+
+    /** Get the symbol id for a production name, adding it to the table if needed. */
+    int32_t productionId(std::string_view name) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            auto it = productionIds.find(name);
+            if (it != productionIds.end()) return it->second;
         }
 
-        size_t idx = strings.size();
-        cachedLocations.emplace(s, idx);
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        auto it = productionIds.find(name); // somebody might've beaten us to it
+        if (it != productionIds.end()) return it->second;
 
-        strings.push_back(s);
+        auto id = static_cast<int32_t>(names.size());
+        productionIds.emplace(names.emplace_back(name), id);
+        return id;
+    }
 
-        return idx;
+    /** Find the symbol id for a production name, or -1 if there is no such production. */
+    int32_t findProduction(std::string_view name) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = productionIds.find(name);
+        return it == productionIds.end() ? -1 : it->second;
     }
-        
+
+    /** Find the symbol id for a token name, or -1 if there is no such token. */
+    int32_t findType(std::string_view name) const {
+        auto it = typeIds.find(name); // never changes after construction
+        return it == typeIds.end() ? -1 : it->second;
+    }
+
     /**
-     * Get an existing string by index.
+     * Find the symbol id for a production name by its address, if it's one of the string literals
+     * in `_production_names`, or -1 otherwise.
     */
-	ustring const& getString(size_t index)  {
-    	return strings[index];
+    int32_t findLiteral(const char* name) const {
+        auto it = literalIds.find(name); // never changes after construction
+        return it == literalIds.end() ? -1 : it->second;
+    }
+
+    /**
+     * Get the name of the given symbol.
+     * 
+     * @throw std::runtime_error if the id is out of range.
+    */
+    std::string const& name(int32_t id) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (id < 0 || static_cast<size_t>(id) >= names.size()) {
+            throw std::runtime_error("Symbol id out of range.");
+        }
+        return names[id]; // deque elements never move
     }
-};
 
-/** Stores mappings from logical token names to string representations. */
-static std::unordered_map<int, ustring> token_name_map;
+    /** Is the given symbol a token type? */
+    bool isTerminal(int32_t id) const {
+        return id >= 0 && id < tokenCount;
+    }
+};
 
-/** Stores mappings from logical literal token names to literal values. */
-static std::unordered_map<int, ustring> token_literal_value_map;
+/**
+ * A range of the input. Offsets are in code units of the input (bytes, or code points in
+ * `--unicode` builds), and lines and columns count from 1. The end is exclusive: it's the
+ * position just past the last code unit. Every field is -1 if the position is unknown.
+*/
+struct Span {
+    int64_t begin; ///< offset of the first code unit
+    int64_t end; ///< offset just past the last code unit
+    int32_t beginLine; ///< line of `begin`
+    int32_t beginColumn; ///< column of `begin`
+    int32_t endLine; ///< line of `end`
+    int32_t endColumn; ///< column of `end`
+
+    /** A span for positions that aren't known. */
+    static constexpr Span unknown() {
+        return Span { -1, -1, -1, -1, -1, -1 };
+    }
+};
 
 /**
  * This is the token value passed into the Lemon parser. It always has a type, 
  * but it might not always have a value. This is indicated by having a 
- * nullptr `valueTable`.
+ * nullptr `valueData`.
+ * 
+ * Values aren't copied. They point into the input being parsed, or into the
+ * parser's `StringTable` when they can't (see `Lexer::make_input_token`).
  * 
  * It seems Token must be a trivial value type to pass through
  * the lemon parser. This means we need to play tricks with
@@ -167,25 +364,26 @@ static std::unordered_map<int, ustring> token_literal_value_map;
 */
 struct Token {
     int type; ///< Numeric type defined by the header 'concat_grammar.h', output by lemon.
-    size_t valueIndex; ///< index into the string table where we can find our value.
-    StringTable *valueTable; ///< pointer to string table of values, or nullptr if this token has no value.
-    int line; ///< line number that the lexer *finished* this token on (sorry)
+    const uuchar* valueData; ///< start of the value, in the input or a string table, or nullptr if this token has no value.
+    size_t valueLength; ///< length of the value.
+    int line; ///< line number that the lexer *finished* this token on (sorry), see `span` for the whole extent
+    Span span; ///< the input this token was lexed from
 
     /**
-     * Get either the regex-matched value for a value token, or just a copy of the
-     * literal string for a literal token.
+     * Get either the regex-matched value for a value token, or the literal string for
+     * a literal token, without copying it.
     */
-    ustring value() const { 
-        if (valueTable) return valueTable->getString(valueIndex);
-        return token_literal_value_map[type];
+    ustring_view valueView() const;
+
+    /** Get a copy of `valueView()`. */
+    ustring value() const {
+        return ustring(valueView());
     }
 
     /**
      * Get the name of this token as a string.
     */
-    ustring const& name() const {
-        return token_name_map[type];
-    }
+    ustring_view name() const;
 
     /**
      * Get a reasonable, perhaps truncated, string representation of this token.
@@ -199,99 +397,360 @@ struct Token {
     int operator~() const { return line; }
 };
 
+/**
+ * A nonterminal production, by symbol id (see `SymbolTable`). Like `Token`, this
+ * is a trivial value type so it can live inside arena-allocated parse nodes.
+*/
+struct Production {
+    int32_t symbol; ///< production symbol id
+
+    /** Get the production name. */
+    std::string const& name() const {
+        return SymbolTable::get().name(symbol);
+    }
+};
+
 /** Convenience method to make a token. */
-Token make_token(int type, int line) {
-    return Token {type, 0, nullptr, line};
+Token make_token(int type, int line, Span const& span = Span::unknown()) {
+    return Token {type, nullptr, 0, line, span};
 }
 
-/** Convenience method to make a token. */
-Token make_token(int type, StringTable & st, ustring const& s, int line) {
-    return Token {type, st.pushString(s), &st, line};
+/** Convenience method to make a token, copying the value into a string table. */
+Token make_token(int type, StringTable & st, ustring_view s, int line, Span const& span = Span::unknown()) {
+    auto value = st.store(s);
+    return Token {type, value.data(), value.size(), line, span};
+}
+
+/** Convenience method to make a token whose value is a view of the input, which must outlive it. */
+Token make_view_token(int type, ustring_view s, int line, Span const& span = Span::unknown()) {
+    return Token {type, s.data(), s.size(), line, span};
 }
 
 
 //============================== LEXER IMPLEMENTATION =================================
 
+/** A run of code units at or above 256 that all share the same DFA character class. */
+struct DFAClassRange {
+    uint32_t first; ///< first code unit in the run
+    uint32_t last; ///< last code unit in the run (inclusive)
+    uint16_t cls; ///< character class
+};
+
 /**
- * This implements a recursive prefix tree, used to match literals in the lexer.
+ * A deterministic finite automaton, compiled from the lexer definition by `BuildDFA.py`
+ * and emitted as static arrays.
  * 
- * Nodes with defined values may also define a terminator pattern, which must match in order for the node to match.
+ * Each input code unit is mapped to a character class, and the next state is found by
+ * indexing the transition table with the current state and that class. State 0 is the
+ * dead state, and state 1 is the start state.
 */
-template <typename V_T>
-struct PTNode {
-    uuchar code; ///< character contribution
-    std::optional<V_T> value; ///< the output token value if matched
-    std::optional<uregex> terminatorPattern; ///< a regex used to check if the literal is properly terminated
-    std::vector<PTNode> children; ///< suffixes
-    bool isRoot; ///< is this the root node?
+struct DFATable {
+    uint16_t classCount; ///< number of character classes
+    uint16_t const* classMap; ///< character class for each code unit below 256
+    DFAClassRange const* classRanges; ///< sorted character classes for code units at or above 256
+    size_t classRangeCount; ///< number of entries in `classRanges`
+    uint16_t const* transitions; ///< next state, indexed by `state * classCount + class`
+    uint16_t const* acceptBegin; ///< offset of each state's accepted rules in `acceptRules`, with one extra entry at the end
+    uint16_t const* acceptRules; ///< rules accepted by each state, in priority order
+
+    /** Get the character class of a code unit. */
+    uint16_t classOf(uuchar c) const {
+        auto u = static_cast<uint32_t>(static_cast<std::make_unsigned_t<uuchar>>(c));
+        if (u < 256) return classMap[u];
+
+        size_t lo = 0, hi = classRangeCount; // find the last range starting at or before `u`
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (classRanges[mid].first <= u) lo = mid;
+            else hi = mid;
+        }
+        return classRanges[lo].cls;
+    }
+
+    /** Get the next state after consuming `c`. */
+    uint16_t step(uint16_t state, uuchar c) const {
+        return transitions[state * classCount + classOf(c)];
+    }
 
-    PTNode(uuchar code, std::optional<V_T> const& value, std::optional<uregex> const& terminator, bool isRoot = false) : code(code), value(value), terminatorPattern(terminator), children(), isRoot(isRoot) {}
+    /** Does the given state accept anything? */
+    bool accepts(uint16_t state) const {
+        return acceptBegin[state] != acceptBegin[state + 1];
+    }
 
     /**
-     * Recursively add a literal to the tree.
+     * Check if any prefix of the input range (including an empty one) matches. If given,
+     * `outOfInput` is set when the range ended before the answer was certain.
     */
-    void add_value(ustring_view const& code, V_T const& value, std::optional<uregex> const& terminator = std::nullopt) {
-        if (code.length() == 0) { // all of the previous recursions have matched (or user is adding a null string?)
-            if (isRoot // yeah, it was a null string, which won't work and is extremely unlikely coming from the autogen lexer conf
-                || this->value) // or we're already set
-                    throw std::runtime_error("Attempting to redefine lexer literal " + toExternal(token_name_map[this->value.value()]));
-            this->value = value;
-            this->terminatorPattern = terminator;
-            return;
-        }
-
-        for (auto & c : children) {
-            if (c.code == code[0]) { // one of our children is further along the chain
-                c.add_value(code.substr(1, code.length() - 1), value, terminator);
-                return;
+    bool matchesPrefix(siter first, siter const& last, bool* outOfInput = nullptr) const {
+        uint16_t state = 1;
+        while (!accepts(state)) {
+            if (first == last) {
+                if (outOfInput) *outOfInput = true;
+                return false;
             }
+            if (!(state = step(state, *first++))) return false;
         }
+        return true;
+    }
+};
 
-        // directly create the child node
-        children.emplace_back(code[0], std::nullopt, std::nullopt);
+/**
+ * DFAs used to locate the capture group of a value pattern `A(G)B`, after the lexer DFA
+ * has already matched the whole pattern. The `Reversed` tables match their pattern backwards,
+ * from the end of the input range.
+*/
+struct DFACapture {
+    DFATable const* prefix; ///< A
+    DFATable const* groupSuffixReversed; ///< GB, reversed
+    DFATable const* group; ///< G
+    DFATable const* suffixReversed; ///< B, reversed
 
-        // and recurse into it with the suffix of the string. If the contracted substring becomes null, that will trigger the child to take the value
-        children.back().add_value(code.substr(1, code.length() - 1), value, terminator);
+    /**
+     * Find the capture group within the complete match [first, last), preferring the
+     * longest prefix and then the longest group. `marks` is scratch space.
+    */
+    std::tuple<siter, siter> find(siter const& first, siter const& last, std::vector<char> & marks) const {
+        auto groupStart = split(*prefix, *groupSuffixReversed, first, last, marks);
+        auto groupEnd = split(*group, *suffixReversed, groupStart, last, marks);
+        return std::make_tuple(groupStart, groupEnd);
     }
 
-    /** Check the terminator pattern, or return true automatically if we don't have a terminator defined.  */
-    bool tryTerminator(ustring::const_iterator const& first, ustring::const_iterator const& last) const {
-        if (!terminatorPattern) return true;
+private:
+    /** Find the last position `p` where `head` matches [first, p) and `tailReversed` matches [p, last). */
+    static siter split(DFATable const& head, DFATable const& tailReversed, siter const& first, siter const& last, std::vector<char> & marks) {
+        size_t length = last - first;
+        marks.assign(length + 1, 0);
+
+        uint16_t state = 1;
+        marks[length] = tailReversed.accepts(state);
+        for (size_t i = length; i > 0 && (state = tailReversed.step(state, first[i - 1])); --i) {
+            marks[i - 1] = tailReversed.accepts(state);
+        }
 
-        return std::regex_search(first, last, terminatorPattern.value(), std::regex_constants::match_continuous);
+        size_t best = 0;
+        state = 1;
+        for (size_t i = 0; i < length && (state = head.step(state, first[i])); ++i) {
+            if (head.accepts(state) && marks[i + 1]) best = i + 1;
+        }
+        return first + best;
     }
+};
 
-    /** Value, and an iterator pointing to the input character immediately following the literal. */
-    using LexResult = std::tuple<V_T, ustring::const_iterator>;
+/** Get the index of the lowest set bit of a nonzero mask. */
+inline unsigned lowestSetBit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/** An inclusive range of code units. */
+struct CharRange {
+    uint32_t lo;
+    uint32_t hi;
+};
+
+/** A set of code units, compiled by `BuildLexer.py` for a `SkipScanner`. */
+struct CharSet {
+    uint32_t bits[8]; ///< membership of each code unit below 256
+    CharRange const* ranges; ///< all members, in order
+    size_t rangeCount; ///< number of entries in `ranges`
+
+    static constexpr size_t MaxVectorRanges = 4; ///< sets made of more ranges than this are scanned one code unit at a time
+    static constexpr ptrdiff_t ShortRun = 8; ///< code units checked one at a time before using SIMD
+
+    /** Is the code unit in the set? */
+    bool contains(uuchar c) const {
+        auto u = static_cast<uint32_t>(static_cast<std::make_unsigned_t<uuchar>>(c));
+        if (u < 256) return (bits[u >> 5] >> (u & 31)) & 1;
+
+        for (size_t i = rangeCount; i > 0 && ranges[i - 1].hi >= u; --i) {
+            if (ranges[i - 1].lo <= u) return true;
+        }
+        return false;
+    }
 
     /**
-     * Try to match the maximal string possible from the beginning of the input range.
+     * Find the first code unit in [first, last) that's in the set, or that isn't if `member`
+     * is false. Returns `last` if there's no such code unit.
     */
-    std::optional<LexResult> tryValue(ustring::const_iterator first, ustring::const_iterator last) const {
-        if (children.empty() || first == last) { // we'll never have a null input, so we've reached end of input or end of chain while still matching.
-            goto bailout;
+    const uuchar* find(const uuchar* first, const uuchar* last, bool member) const {
+        for (auto shortRun = first + std::min<ptrdiff_t>(last - first, ShortRun); first != shortRun; ++first) {
+            if (contains(*first) == member) return first; // most runs are short, and not worth the SIMD setup
         }
 
-        for (auto const& c : children) {
-            if (*first == c.code) {
-                if (auto found = c.tryValue(first + 1, last)) {
-                    return found;
-                }
+        if constexpr (sizeof(uuchar) == 1) {
+            if (rangeCount <= MaxVectorRanges) {
+                first = reinterpret_cast<const uuchar*>(findVector(reinterpret_cast<const char*>(first), reinterpret_cast<const char*>(last), member));
             }
         }
+        while (first != last && contains(*first) != member) ++first;
+        return first;
+    }
 
-        bailout:
-        // if we got here naturally, after searching children, it's because there was a match failure on the
-        // suffix after this node. If we have a value, check the terminator and return.
-        if (value && tryTerminator(first, last)) {
-            return std::make_tuple(value.value(), first);
+private:
+    /** The SIMD part of `find()`, which returns at the first match or before the final partial block. */
+    const char* findVector(const char* first, const char* last, bool member) const {
+#ifdef LEMON_PY_AVX2
+        {
+            __m256i lo[MaxVectorRanges], width[MaxVectorRanges];
+            for (size_t i = 0; i < rangeCount; i++) {
+                lo[i] = _mm256_set1_epi8(static_cast<char>(ranges[i].lo));
+                width[i] = _mm256_set1_epi8(static_cast<char>(ranges[i].hi - ranges[i].lo));
+            }
+            for (; last - first >= 32; first += 32) {
+                auto block = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(first));
+                auto hits = _mm256_setzero_si256();
+                for (size_t i = 0; i < rangeCount; i++) { // unsigned `c - lo <= hi - lo`
+                    auto offset = _mm256_sub_epi8(block, lo[i]);
+                    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(_mm256_min_epu8(offset, width[i]), offset));
+                }
+                auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+                if (!member) mask = ~mask;
+                if (mask) return first + lowestSetBit(mask);
+            }
+        }
+#endif
+#ifdef LEMON_PY_SSE2
+        {
+            __m128i lo[MaxVectorRanges], width[MaxVectorRanges];
+            for (size_t i = 0; i < rangeCount; i++) {
+                lo[i] = _mm_set1_epi8(static_cast<char>(ranges[i].lo));
+                width[i] = _mm_set1_epi8(static_cast<char>(ranges[i].hi - ranges[i].lo));
+            }
+            for (; last - first >= 16; first += 16) {
+                auto block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(first));
+                auto hits = _mm_setzero_si128();
+                for (size_t i = 0; i < rangeCount; i++) {
+                    auto offset = _mm_sub_epi8(block, lo[i]);
+                    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(_mm_min_epu8(offset, width[i]), offset));
+                }
+                auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+                if (!member) mask = ~mask & 0xFFFF;
+                if (mask) return first + lowestSetBit(mask);
+            }
         }
+#endif
+        (void) last; (void) member;
+        return first;
+    }
+};
 
-        // no match, or the match is for an internal node with no value.
-        return std::nullopt;
+/** Shapes of skip pattern with a specialized scanner. */
+enum class SkipScannerKind { Run, Line, Block };
+
+/**
+ * A specialized scanner for a skip pattern with a common shape, recognized by `BuildLexer.py`:
+ * 
+ *  - `Run` matches a run of characters in `set`, like `\s+`.
+ *  - `Line` matches `prefix` and everything up to the first character in `set`, like `#.*`.
+ *    If there's a one-character `suffix`, the match must end with it, like `//.*\n`.
+ *  - `Block` matches `prefix` and everything up to and including the next `suffix`, like
+ *    `/\*[\s\S]*?\*\/`.
+ * 
+ * These skip whitespace and comments with SIMD or `std::search`, instead of stepping the
+ * lexer DFA one code unit at a time. Each gives exactly the same match as its pattern.
+*/
+struct SkipScanner {
+    SkipScannerKind kind;
+    CharSet const* set; ///< run characters for `Run`, stop characters for `Line`, unused for `Block`
+    const uuchar* prefix; ///< fixed start of a `Line` or `Block`
+    size_t prefixLength; ///< length of `prefix`
+    const uuchar* suffix; ///< fixed end of a `Line` or `Block`, which may be empty for `Line`
+    size_t suffixLength; ///< length of `suffix`
+    size_t rule; ///< index of the skip rule this scans for, in `LexerDef::rules`
+
+    /** Can a match start with the given code unit? */
+    bool startsWith(uuchar c) const {
+        return kind == SkipScannerKind::Run ? set->contains(c) : prefix[0] == c;
+    }
+
+    /** Can a match start with a code unit above 255? */
+    bool startsWide() const {
+        if (kind == SkipScannerKind::Run) return set->ranges[set->rangeCount - 1].hi > 255;
+        auto first = static_cast<uint32_t>(static_cast<std::make_unsigned_t<uuchar>>(prefix[0])); // widened, so byte lexers don't compare a byte against 255
+        return first > 255;
+    }
+
+    /**
+     * Get the end of the match at the start of [first, last), or nullptr if there isn't one.
+     * `outOfInput` is set when input past `last` could change the answer.
+    */
+    const uuchar* match(const uuchar* first, const uuchar* last, bool & outOfInput) const {
+        if (static_cast<size_t>(last - first) < prefixLength) {
+            outOfInput = std::equal(first, last, prefix);
+            return nullptr;
+        }
+        if (!std::equal(prefix, prefix + prefixLength, first)) return nullptr;
+        auto body = first + prefixLength;
+
+        switch (kind) {
+        case SkipScannerKind::Run: {
+            auto end = set->find(body, last, false);
+            outOfInput = end == last;
+            return end == first ? nullptr : end;
+        }
+        case SkipScannerKind::Line: {
+            auto end = set->find(body, last, true);
+            if (end == last) {
+                outOfInput = true;
+                return suffixLength ? nullptr : end;
+            }
+            if (!suffixLength) return end;
+            return *end == suffix[0] ? end + 1 : nullptr;
+        }
+        case SkipScannerKind::Block: {
+            auto end = std::search(body, last, suffix, suffix + suffixLength);
+            if (end == last) {
+                outOfInput = true;
+                return nullptr;
+            }
+            return end + suffixLength;
+        }
+        }
+        return nullptr;
     }
 };
 
+/**
+ * A literal terminator that only looks at the next character, checked with a bitmap instead
+ * of a DFA. It's either a character class like `[^\w_]`, or a negative lookahead for one
+ * like `(?!\+)`, which also matches at the end of input.
+*/
+struct TerminatorClass {
+    CharSet set; ///< characters that may follow the literal
+    bool atEnd; ///< does the terminator match at the end of input?
+};
+
+/** Kinds of lexer rule. */
+enum class LexRuleKind { Skip, Literal, Value };
+
+/**
+ * A single skip, literal, or value definition, compiled by `BuildLexer.py`.
+ * 
+ * Rules are stored in priority order, and each has a rank. A match for a lower rank
+ * always beats a match for a higher rank, no matter the length. Between equal ranks,
+ * the longest match wins. All skips share rank 0, all literals share rank 1, and every
+ * value pattern has its own rank following its definition order.
+*/
+struct LexRule {
+    LexRuleKind kind;
+    int tokCode; ///< token code, unused for skips
+    int rank; ///< match priority, lowest first
+    int pattern; ///< index of the `std::regex` used if this pattern couldn't be compiled into the lexer DFA, or -1
+    DFATable const* terminator; ///< literal terminator pattern, or nullptr
+    TerminatorClass const* terminatorClass; ///< literal terminator checked with a bitmap, used instead of `terminator`, or nullptr
+    int terminatorPattern; ///< index of the `std::regex` used for a terminator that couldn't be compiled, or -1
+    DFACapture const* capture; ///< DFAs to find the sub-match of value patterns with a capture group, or nullptr
+    SkipScanner const* scanner; ///< specialized scanner for a skip, used in place of `pattern` or for `LexerDef::fastSkips`, or nullptr
+    CharSet const* first; ///< code units a match of the `std::regex` fallback can start with, or nullptr if it could be any
+    bool spansLines; ///< can the `std::regex` fallback match or look past a line break, or depend on where the input ends?
+    const char* name; ///< skip or token name from the lexdef
+};
+
 /** Flags for regex scanning. */
 struct RegexScannerFlags {
     const int v = 0;
@@ -328,118 +787,509 @@ uregex s2regex(ustring const& s, RegexScannerFlags const& flags) {
     return uregex(s, flagset);
 }
 
+/** The name and literal value of a token code, generated by `BuildLexer.py`. */
+struct TokenInfo {
+    const uuchar* name = nullptr; ///< token name, or nullptr if the code isn't a token
+    const uuchar* literal = nullptr; ///< literal token value, or nullptr if this isn't a literal
+};
+
+/**
+ * The lexer definition generated from the `@lexdef` block.
+ * 
+ * This is built exactly once, on first use, by the codegen'd `_init_lexer()`, and is
+ * never modified after that. Any number of lexers on any number of threads can share it.
+*/
+struct LexerDef {
+    DFATable const* dfa = nullptr; ///< combined DFA for all skips, literals, and values
+    LexRule const* rules = nullptr; ///< rule table, indexed by the rules accepted in `dfa`
+    size_t ruleCount = 0; ///< number of entries in `rules`
+    std::vector<size_t> fallbackRules; ///< indices of rules matched by `std::regex` instead of `dfa`, in priority order
+    std::array<std::vector<size_t>, 256> fallbackRulesByUnit; ///< the `fallbackRules` whose match can start with each code unit below 256
+    std::vector<uregex> patterns; ///< `std::regex` fallbacks, referenced by index from `rules`
+    std::vector<std::tuple<uuchar, uuchar, int, StringScannerFlags>> stringDefs; ///< delim, escape, token code, span newlines
+    TokenInfo const* tokens = nullptr; ///< static token table, indexed by token code
+    size_t tokenCount = 0; ///< number of entries in `tokens`
+    bool fastSkips = false; ///< skip with the skip rules' `SkipScanner`s, instead of the lexer DFA?
+    std::array<SkipScanner const*, 256> skipScanners {}; ///< the skip scanner that can start with each code unit below 256
+    std::vector<SkipScanner const*> wideSkipScanners; ///< skip scanners that can start with larger code units
+
+    /** Get the lexer definition, building it on first use. */
+    static LexerDef const& get();
+
+    /** Get the name of a token code, or an empty string if it's unknown. */
+    ustring_view tokenName(int tokCode) const {
+        return view(tokCode >= 0 && static_cast<size_t>(tokCode) < tokenCount ? tokens[tokCode].name : nullptr);
+    }
+
+    /** Get the value of a literal token code, or an empty string if it's unknown. */
+    ustring_view literalValue(int tokCode) const {
+        return view(tokCode >= 0 && static_cast<size_t>(tokCode) < tokenCount ? tokens[tokCode].literal : nullptr);
+    }
+
+    // == building, used only by `_init_lexer()` ==
+
+    /** Set the compiled lexer DFA and rule table. */
+    void set_rules(DFATable const* dfa, LexRule const* rules, size_t ruleCount) {
+        this->dfa = dfa;
+        this->rules = rules;
+        this->ruleCount = ruleCount;
+
+        fallbackRules.clear();
+        for (auto & list : fallbackRulesByUnit) list.clear();
+        for (size_t i = 0; i < ruleCount; i++) {
+            if (rules[i].pattern < 0) continue;
+            fallbackRules.push_back(i);
+            for (uint32_t c = 0; c < 256; c++) {
+                if (!rules[i].first || rules[i].first->contains(static_cast<uuchar>(c))) fallbackRulesByUnit[c].push_back(i);
+            }
+        }
+    }
+
+    /**
+     * Get the fallback rules that might match starting with the given code unit, in priority order.
+     * Code units past 255 get all of them, so check those against each rule's `first`.
+    */
+    std::vector<size_t> const& fallbackRulesFor(uuchar c) const {
+        auto u = static_cast<uint32_t>(static_cast<std::make_unsigned_t<uuchar>>(c));
+        return u < 256 ? fallbackRulesByUnit[u] : fallbackRules;
+    }
+
+    /** Get the skip scanner that can start with the given code unit, if `fastSkips` is set. */
+    SkipScanner const* skipScannerFor(uuchar c) const {
+        auto u = static_cast<uint32_t>(static_cast<std::make_unsigned_t<uuchar>>(c));
+        if (u < 256) return skipScanners[u];
+
+        for (auto scanner : wideSkipScanners) {
+            if (scanner->startsWith(c)) return scanner;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Skip with the skip rules' scanners alone. `BuildLexer.py` only does this when every skip has
+     * a scanner, and no two skips can start with the same character. Since skips outrank everything,
+     * the one skip that can start at a position is then the only possible match.
+    */
+    void enable_fast_skips() {
+        fastSkips = true;
+        for (size_t i = 0; i < ruleCount; i++) {
+            auto scanner = rules[i].scanner;
+            if (rules[i].kind != LexRuleKind::Skip || !scanner) continue;
+
+            for (uint32_t c = 0; c < 256; c++) {
+                if (scanner->startsWith(static_cast<uuchar>(c))) skipScanners[c] = scanner;
+            }
+            if (scanner->startsWide()) wideSkipScanners.push_back(scanner);
+        }
+    }
+
+    /** Add a `std::regex` fallback pattern, used for patterns and terminators the DFA compiler can't handle. */
+    void add_pattern(ustring const& r, RegexScannerFlags const& flags = RegexScannerFlags::Default) {
+        patterns.push_back(s2regex(r, flags));
+    }
+
+    /** Set the static table of token names and literal values. Matching is done by the lexer DFA. */
+    void set_tokens(TokenInfo const* tokens, size_t tokenCount) {
+        this->tokens = tokens;
+        this->tokenCount = tokenCount;
+    }
+
+    /** Add a string definition to the lexer definition. */
+    void add_string_def(uuchar delim, uuchar escape, int tok_code, StringScannerFlags flags = StringScannerFlags::Default) {
+        stringDefs.push_back(std::make_tuple(delim, escape, tok_code, flags));
+    }
+
+private:
+    /** View a string from the token table, which may be nullptr. */
+    static ustring_view view(const uuchar* s) {
+        return s ? ustring_view(s) : ustring_view();
+    }
+};
+
+/** Forward declaration of codegen'd lexer initialization function. Defined by the BuildLexer.py */
+void _init_lexer(LexerDef & lexer);
+
+LexerDef const& LexerDef::get() {
+    static LexerDef const def = [] {
+        LexerDef retval;
+        _init_lexer(retval);
+        return retval;
+    }();
+    return def;
+}
+
+ustring_view Token::valueView() const { 
+    if (valueData) return ustring_view(valueData, valueLength);
+    return LexerDef::get().literalValue(type);
+}
+
+ustring_view Token::name() const {
+    return LexerDef::get().tokenName(type);
+}
+
+#ifdef LEMON_PY_PROFILE
+
+/** Attempt, hit, and time counters for one part of the lexer. Shared by every thread. */
+struct ProfileSlot {
+    std::atomic<uint64_t> attempts {0};
+    std::atomic<uint64_t> hits {0};
+    std::atomic<uint64_t> nanoseconds {0};
+
+    void attempt() { attempts.fetch_add(1, std::memory_order_relaxed); }
+    void hit() { hits.fetch_add(1, std::memory_order_relaxed); }
+    void time(std::chrono::steady_clock::duration d) { nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), std::memory_order_relaxed); }
+
+    void reset() {
+        attempts = 0;
+        hits = 0;
+        nanoseconds = 0;
+    }
+};
+
+/** Adds the time until it's destroyed to a `ProfileSlot`. */
+struct ProfileTimer {
+    ProfileSlot & slot;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    ~ProfileTimer() { slot.time(std::chrono::steady_clock::now() - start); }
+};
+
+/**
+ * The counters of a parser built with `lempy_build --profile`, for every parse in the process.
+ * Lexer rules and string definitions are counted by their index in the `LexerDef`, and grammar
+ * rules by their Lemon rule number.
+*/
+struct Profile {
+    enum Step { Next, Skip, String, Scan, Literal, Value, StepCount };
+    static constexpr const char* stepNames[StepCount] = { "next", "skip", "string", "scan", "literal", "value" };
+
+    ProfileSlot steps[StepCount]; ///< each step of the lexer, as a whole
+    std::unique_ptr<ProfileSlot[]> rules; ///< each skip, literal, and value rule
+    std::unique_ptr<ProfileSlot[]> strings; ///< each string definition
+    std::unique_ptr<std::atomic<uint64_t>[]> reductions; ///< reductions of each grammar rule
+    size_t grammarRuleCount = 0; ///< number of entries in `reductions`
+    std::atomic<uint64_t> shifts {0}; ///< tokens shifted
+
+    Profile() {
+        auto const& def = LexerDef::get();
+        rules = std::make_unique<ProfileSlot[]>(def.ruleCount);
+        strings = std::make_unique<ProfileSlot[]>(def.stringDefs.size());
+        while (LemonPyParseRuleName(static_cast<int>(grammarRuleCount))) grammarRuleCount++;
+        reductions = std::make_unique<std::atomic<uint64_t>[]>(grammarRuleCount);
+    }
+
+    /** Get the counters. */
+    static Profile & get() {
+        static Profile profile;
+        return profile;
+    }
+
+    /** Get the counters for a lexer rule. */
+    ProfileSlot & rule(LexRule const* r) {
+        return rules[r - LexerDef::get().rules];
+    }
+
+    /** Get the counters for the skip rule a skip scanner belongs to. */
+    ProfileSlot & skipScanner(SkipScanner const* scanner) {
+        assert(scanner->rule < LexerDef::get().ruleCount && LexerDef::get().rules[scanner->rule].scanner == scanner);
+        return rules[scanner->rule];
+    }
+};
+
+inline void profile_shift(bool token) {
+    if (token) Profile::get().shifts.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void profile_reduce(int rule) {
+    Profile::get().reductions[rule].fetch_add(1, std::memory_order_relaxed);
+}
+
+#define LEMON_PY_PROFILE_ATTEMPT(slot) (slot).attempt()
+#define LEMON_PY_PROFILE_HIT(slot) (slot).hit()
+#define LEMON_PY_PROFILE_TIME(name, slot) ProfileTimer name { slot }
+
+#else
+
+inline void profile_shift(bool) {}
+inline void profile_reduce(int) {}
+
+#define LEMON_PY_PROFILE_ATTEMPT(slot)
+#define LEMON_PY_PROFILE_HIT(slot)
+#define LEMON_PY_PROFILE_TIME(name, slot)
+
+#endif
+
 /**
  * This is a relatively basic lexer. It handles two classes of tokens, plus skip patterns and strings.
  * 
- * "literal" tokens are defined by a fixed string of characters, and are stored in a basic
- * prefix tree (PTNode above). These are matched greedily, with the longest matching sequence
- * having priority. Literal tokens are returned by lemon-defined code number, without a value.
+ * Skip, literal, and value definitions are all compiled at grammar build time into a single
+ * DFA (see `BuildDFA.py`), so finding the next match is one pass over the input, stopping when
+ * no rule could match any more input. The winner is chosen by rank (see `LexRule`).
+ * 
+ * "literal" tokens are defined by a fixed string of characters. These are matched greedily,
+ * with the longest matching sequence having priority. Literal tokens are returned by
+ * lemon-defined code number, without a value.
  * 
  * "value" tokens are defined by a regular expression, and are returned with both a code
  * and a value. A single sub-match may be used to denote a partial value extraction from
  * the overall token match. No type conversions are done, all values are strings.
  * 
- * Value token patterns are checked in the same order they are defined with `add_value_type`.
+ * Value token patterns have priority in the same order they are defined.
  * 
  * Skip patterns are simply regexes that are used to skip whitespace, comments, or other
  * lexically and syntactically-irrelevant content. Skip patterns are applied before every
  * attempt at token extraction.
  * 
+ * Patterns using regex features the DFA can't express fall back to `std::regex`, and are
+ * checked after the DFA pass only if they could outrank its result.
+ * 
  * Strings have user-defined delimeters and escapes, and may optionally span newlines.
  * 
 */
 struct Lexer {
-    static PTNode<int> literals;
-    static std::vector<uregex> skips;
-    static std::vector<std::tuple<uregex, int>> valueTypes; ///< regex pattern, token code
-    static std::vector<std::tuple<uuchar, uuchar, int, StringScannerFlags>> stringDefs; ///< delim, escape, token code, span newlines
-
-    /**
-     * Add a literal/constant token, with an optional terminator pattern.
-    */
-    static void add_literal(int tok_code, ustring const& code, std::optional<ustring> const& terminator = std::nullopt, RegexScannerFlags const& terminatorFlags = RegexScannerFlags::Default) {
-        literals.add_value(
-                          code, 
-                          tok_code, 
-                          terminator ? 
-                            std::make_optional(s2regex(terminator.value(), terminatorFlags))
-                            : std::nullopt);
-        token_literal_value_map.emplace(tok_code, code);
-    }
-
-    /** Add a skip pattern to the lexer definition. */
-    static void add_skip(ustring const& r, RegexScannerFlags const& flags = RegexScannerFlags::Default) {
-        skips.push_back(s2regex(r, flags));
-    }
-
-    /** Add a value pattern to the lexer definition. */
-    static void add_value_type(int tok_code, ustring const& r, RegexScannerFlags const& flags = RegexScannerFlags::Default) {
-        valueTypes.push_back(std::make_tuple(s2regex(r, flags), tok_code));
-    }
+private:
+    /** The best rule matched at some position. */
+    struct Match {
+        LexRule const* rule; ///< the matched rule
+        siter end; ///< end of the matched input
+        std::optional<std::tuple<siter, siter>> submatch; ///< value sub-match found by a `std::regex` fallback
+    };
 
-    /** Add a string definition to the lexer definition. */
-    static void add_string_def(uuchar delim, uuchar escape, int tok_code, StringScannerFlags flags = StringScannerFlags::Default) {
-        stringDefs.push_back(std::make_tuple(delim, escape, tok_code, flags));
-    }
+    /** Thrown internally when a token can't be decided without input that hasn't arrived yet. */
+    struct NeedInput {};
 
-    // == instance ==
-private:
-    ustring input; ///< the entire input string to lex
-    ustring::const_iterator curPos; ///< current authoritative position in the string
+    LexerDef const& def; ///< the lexer definition
+    ustring_view input; ///< the entire input to lex, which must outlive any tokens taken from it
+    siter curPos; ///< current authoritative position in the string
+    bool copyValues = false; ///< copy token values out of the input? set when the input won't outlive the tokens
+    bool moreInput = false; ///< might more input follow the end of `input`?
     StringTable &stringTable; ///< reference to parser string table to use
     int count; ///< count of tokens lexed
     bool reachedEnd; ///< have we reached the end?
     int line = 1; ///< what's our current line?
+    int64_t inputOffset = 0; ///< offset of the start of `input` in the whole (streamed) input
+    int64_t lineStart = 0; ///< offset of the start of the current line in the whole input
+    std::optional<Match> lastMatch; ///< result of the last `scan()`
+    siter lastMatchPos; ///< position of the last `scan()`
+    bool scanned = false; ///< is `lastMatch` valid at all?
+    std::vector<char> captureMarks; ///< scratch space for `DFACapture`
     
     /** Make a runtime error with context info. */
     std::runtime_error make_error(std::string const& message) {
         char buf[1024];
         snprintf(buf, 1024, "Lexer failure on line %d. %s Around here:\n", line, message.c_str());
-        return std::runtime_error(std::string(buf) + toExternal(remainder(100)));
+        auto context = remainder(100);
+#ifdef LEMON_PY_UTF8_SUPPORT
+        context.resize(completeUtf8Prefix(context)); // don't cut a character in half
+#endif
+        return std::runtime_error(std::string(buf) + toExternal(context));
     }
 
     /** Advance curPos by the given count. */
     siter advanceBy(size_t count) {
-        auto oldPos = curPos;
-        std::advance(curPos, count);
-        line += countLines(oldPos, curPos);
-
-        return oldPos;
+        return advanceTo(curPos + count);
     }
 
     /** Advance curPos to the given position. */
     siter advanceTo(siter const& newPos) {
         auto oldPos = curPos;
         curPos = newPos;
-        line += countLines(oldPos, curPos);
+        trackLines(oldPos, curPos);
 
         return oldPos;
     }
 
-    /** Count lines between iterators. */
-    int countLines(siter from, siter const& to) {
-        int lineCount = 0;
-        for (; from != to; from++) {
-            if (*from == '\n') {
-                lineCount++;
-            }
-        }
-        return lineCount;
+    /** Find the next newline in a range of the input, or `last` if there isn't one. */
+    static const char* findNewline(const char* first, const char* last) {
+        auto found = static_cast<const char*>(std::memchr(first, '\n', last - first));
+        return found ? found : last;
     }
 
-    /** Repeatedly apply skip patterns, consuming input if they match. */
-    void skip() {
-        bool skipped = false;
-        do { 
-            skipped = false;
-            for (auto const& r : skips) {
-                regex_results results;
-                if (std::regex_search(curPos, input.cend(), results, r, std::regex_constants::match_continuous)) {
-                    skipped = true;
-                    advanceBy(results.length());
-                }
-            }
-        } while (skipped);
+    /** Find the next newline in a range of the input, or `last` if there isn't one. */
+    static const wchar_t* findNewline(const wchar_t* first, const wchar_t* last) {
+        auto found = std::wmemchr(first, L'\n', last - first);
+        return found ? found : last;
+    }
+
+    /** Update the line count and line start for input consumed between iterators. */
+    void trackLines(siter const& from, siter const& to) {
+        auto last = input.data() + (to - input.cbegin()); // `to` may be the end, so don't dereference it
+        for (auto p = findNewline(input.data() + (from - input.cbegin()), last); p != last; p = findNewline(p + 1, last)) {
+            line++;
+            lineStart = inputOffset + (p + 1 - input.data());
+        }
+    }
+
+    /** Get an empty span at the current position. */
+    Span here() const {
+        int64_t offset = inputOffset + (curPos - input.cbegin());
+        int32_t column = static_cast<int32_t>(offset - lineStart + 1);
+        return Span { offset, offset, line, column, line, column };
+    }
+
+    /** Get the span from `start` to the current position. */
+    Span spanFrom(Span start) const {
+        auto end = here();
+        start.end = end.end;
+        start.endLine = end.endLine;
+        start.endColumn = end.endColumn;
+        return start;
+    }
+
+    /** Get the part of the input between two positions. */
+    ustring_view slice(siter const& first, siter const& last) const {
+        return input.substr(first - input.cbegin(), last - first);
+    }
+
+    /** Make a token whose value is the given part of the input. */
+    Token make_input_token(int type, ustring_view value, int line, Span const& span) {
+        if (copyValues) return make_token(type, stringTable, value, line, span);
+        return make_view_token(type, value, line, span);
+    }
+
+    /** Check the rule's terminator pattern, if any, at the given position. */
+    bool tryTerminator(LexRule const& rule, siter const& pos) const {
+        if (rule.terminatorClass) {
+            if (pos != input.cend()) return rule.terminatorClass->set.contains(*pos);
+            if (moreInput) throw NeedInput {};
+            return rule.terminatorClass->atEnd;
+        }
+        if (rule.terminator) {
+            bool outOfInput = false;
+            bool retval = rule.terminator->matchesPrefix(pos, input.cend(), &outOfInput);
+            if (outOfInput && moreInput) throw NeedInput {};
+            return retval;
+        }
+        if (rule.terminatorPattern >= 0) {
+            return std::regex_search(pos, input.cend(), def.patterns[rule.terminatorPattern], std::regex_constants::match_continuous);
+        }
+        return true;
+    }
+
+    /** Run a skip scanner at the current position, returning the end of its match, if any. */
+    std::optional<siter> trySkipScanner(SkipScanner const& scanner) const {
+        bool outOfInput = false;
+        auto first = input.data() + (curPos - input.cbegin());
+        auto end = scanner.match(first, input.data() + input.size(), outOfInput);
+        if (outOfInput && moreInput) throw NeedInput {};
+        if (!end) return std::nullopt;
+        return curPos + (end - first);
+    }
+
+    /**
+     * Find the best skip, literal, or value match at the current position. The result is
+     * remembered, since `skip()` needs to look at the next match to find out it's not a skip.
+    */
+    std::optional<Match> const& scan() {
+        if (scanned && lastMatchPos == curPos) return lastMatch;
+        scanned = true;
+        lastMatchPos = curPos;
+        lastMatch.reset();
+        LEMON_PY_PROFILE_ATTEMPT(Profile::get().steps[Profile::Scan]);
+        LEMON_PY_PROFILE_TIME(scanTimer, Profile::get().steps[Profile::Scan]);
+#ifdef LEMON_PY_PROFILE
+        auto dfaStart = std::chrono::steady_clock::now();
+#endif
+
+        int bestRank = std::numeric_limits<int>::max();
+        uint16_t state = 1;
+        auto it = curPos;
+        for (; it != input.cend() && (state = def.dfa->step(state, *it++)); ) {
+            for (auto a = def.dfa->acceptBegin[state]; a != def.dfa->acceptBegin[state + 1]; ++a) {
+                auto const& rule = def.rules[def.dfa->acceptRules[a]];
+                if (rule.rank > bestRank) break;
+                LEMON_PY_PROFILE_ATTEMPT(Profile::get().rule(&rule));
+                if (!tryTerminator(rule, it)) continue;
+
+                bestRank = rule.rank;
+                lastMatch = Match { &rule, it, std::nullopt };
+                break;
+            }
+        }
+        if (moreInput && state && it == input.cend()) { // a longer match might still be coming
+            throw NeedInput {};
+        }
+#ifdef LEMON_PY_PROFILE
+        auto dfaTime = std::chrono::steady_clock::now() - dfaStart;
+#endif
+
+        static std::vector<size_t> const noRules;
+        auto const& candidates = curPos == input.cend() ? noRules : def.fallbackRulesFor(*curPos); // only rules that can match from here
+        if (moreInput && !candidates.empty() && def.rules[candidates.front()].rank <= bestRank) {
+            // we can't tell where a regex stops. Most can't look past a line break, but the rest need all the input.
+            for (auto r : candidates) {
+                auto const& rule = def.rules[r];
+                if (rule.rank > bestRank) break;
+                if (rule.spansLines && !rule.scanner && (!rule.first || rule.first->contains(*curPos))) throw NeedInput {};
+            }
+            if (std::find(curPos, input.cend(), '\n') == input.cend()) throw NeedInput {};
+        }
+
+        for (auto r : candidates) {
+            auto const& rule = def.rules[r];
+            if (rule.rank > bestRank) break;
+            if (rule.first && !rule.first->contains(*curPos)) continue; // a code unit past 255, which gets every rule
+            LEMON_PY_PROFILE_ATTEMPT(Profile::get().rule(&rule));
+            LEMON_PY_PROFILE_TIME(regexTimer, Profile::get().rule(&rule));
+
+            if (rule.scanner) { // a skip with a simple shape doesn't need the regex
+                auto end = trySkipScanner(*rule.scanner);
+                if (end && (rule.rank < bestRank || *end > lastMatch->end)) {
+                    bestRank = rule.rank;
+                    lastMatch = Match { &rule, *end, std::nullopt };
+                }
+                continue;
+            }
+
+            regex_results results;
+            if (std::regex_search(curPos, input.cend(), results, def.patterns[rule.pattern], std::regex_constants::match_continuous) && results.length() > 0) {
+                auto end = curPos + results.length();
+                if (moreInput && end == input.cend()) {
+                    throw NeedInput {};
+                }
+                if (rule.rank < bestRank || end > lastMatch->end) {
+                    auto const& sub = results[results.size() > 1 ? 1 : 0]; // skip past the whole match to get a submatch
+                    bestRank = rule.rank;
+                    lastMatch = Match { &rule, end, std::make_tuple(sub.first, sub.second) };
+                }
+            }
+        }
+
+#ifdef LEMON_PY_PROFILE
+        if (lastMatch) {
+            Profile::get().steps[Profile::Scan].hit();
+            Profile::get().rule(lastMatch->rule).time(dfaTime); // the winner pays for the DFA pass that found it
+        }
+#endif
+        return lastMatch;
+    }
+
+    /** Repeatedly apply skip patterns, consuming input if they match. */
+    void skip() {
+        LEMON_PY_PROFILE_ATTEMPT(Profile::get().steps[Profile::Skip]);
+        LEMON_PY_PROFILE_TIME(skipTimer, Profile::get().steps[Profile::Skip]);
+        if (def.fastSkips) {
+            while (curPos != input.cend()) {
+                auto scanner = def.skipScannerFor(*curPos);
+                if (!scanner) return;
+                LEMON_PY_PROFILE_ATTEMPT(Profile::get().skipScanner(scanner));
+                LEMON_PY_PROFILE_TIME(scannerTimer, Profile::get().skipScanner(scanner));
+                auto end = trySkipScanner(*scanner);
+                if (!end) return;
+                LEMON_PY_PROFILE_HIT(Profile::get().skipScanner(scanner));
+                LEMON_PY_PROFILE_HIT(Profile::get().steps[Profile::Skip]);
+                advanceTo(*end);
+            }
+            return;
+        }
+
+        for (;;) {
+            auto const& m = scan();
+            if (!m || m->rule->kind != LexRuleKind::Skip) return;
+            LEMON_PY_PROFILE_HIT(Profile::get().rule(m->rule));
+            LEMON_PY_PROFILE_HIT(Profile::get().steps[Profile::Skip]);
+            advanceTo(m->end);
+        }
     }
 
     /** Find the end of the string from the given start position. */
@@ -462,17 +1312,19 @@ private:
         }
 
         end_of_input:
+        if (moreInput) throw NeedInput {};
         throw make_error("String lexing reached end of line.");
     }
 
     /** Try all of the string definitions and attempt to get a string, returning nullopt if no string is possible. */
     std::optional<Token> nextString() {
         auto n = [this] (int tokCode, uuchar delim, uuchar escape, StringScannerFlags flags) -> std::optional<Token> {
-            if (*curPos == delim) { // if we get past this, we're either going to return a string token or exception out.
+            if (curPos != input.cend() && *curPos == delim) { // if we get past this, we're either going to return a string token or exception out.
                 auto send = stringEnd(delim, escape, flags, curPos + 1, input.cend());
                 auto startLine = line;
+                auto start = here();
                 auto sstart = advanceTo(send + 1); // move past the end delim
-                return make_token(tokCode, stringTable, ustring(sstart + 1, send), startLine);
+                return make_input_token(tokCode, slice(sstart + 1, send), startLine, spanFrom(start));
             }
             else { 
                 return std::nullopt;
@@ -480,19 +1332,31 @@ private:
         };
 
         using std::get;
+        LEMON_PY_PROFILE_ATTEMPT(Profile::get().steps[Profile::String]);
+        LEMON_PY_PROFILE_TIME(stringTimer, Profile::get().steps[Profile::String]);
 
-        for (auto const& sdef : stringDefs) {
+        for (auto const& sdef : def.stringDefs) {
+            LEMON_PY_PROFILE_ATTEMPT(Profile::get().strings[&sdef - def.stringDefs.data()]);
+            LEMON_PY_PROFILE_TIME(defTimer, Profile::get().strings[&sdef - def.stringDefs.data()]);
             if (auto matchedString = n(get<2>(sdef), get<0>(sdef), get<1>(sdef), get<3>(sdef))) {
+                LEMON_PY_PROFILE_HIT(Profile::get().strings[&sdef - def.stringDefs.data()]);
+                LEMON_PY_PROFILE_HIT(Profile::get().steps[Profile::String]);
                 auto flags = get<3>(sdef);
                 if (flags & StringScannerFlags::JoinAdjacent) {
                     sstream retval;
                     retval << matchedString.value().value();
+                    auto span = matchedString.value().span;
                     skip();
+                    if (moreInput && consumedInput()) throw NeedInput {}; // can't tell if another string follows
                     while (auto anotherOne = n(get<2>(sdef), get<0>(sdef), get<1>(sdef), get<3>(sdef))) {
                         retval << anotherOne.value().value(); // get the actual string value out, the first one's for the `optional`
+                        span.end = anotherOne.value().span.end; // strings are joined in input order
+                        span.endLine = anotherOne.value().span.endLine;
+                        span.endColumn = anotherOne.value().span.endColumn;
                         skip();
+                        if (moreInput && consumedInput()) throw NeedInput {};
                     }
-                    return make_token(matchedString.value().type, stringTable, retval.str(), matchedString.value().line);
+                    return make_token(matchedString.value().type, stringTable, retval.str(), matchedString.value().line, span);
                 }
                 else {
                     return matchedString;
@@ -503,74 +1367,144 @@ private:
         return std::nullopt;
     }
 
-    /** Query the prefix tree to check for a literal token, returning nullopt if nothing matches. */
-    std::optional<Token> nextLiteral() {
-        auto result = literals.tryValue(curPos, input.cend());
-        if (!result) return std::nullopt;
-
-        advanceTo(std::get<1>(result.value()));
-        return make_token(std::get<0>(result.value()), line);
+    /** Emit a literal token for the given match. */
+    std::optional<Token> nextLiteral(Match const& m) {
+        LEMON_PY_PROFILE_ATTEMPT(Profile::get().steps[Profile::Literal]);
+        LEMON_PY_PROFILE_HIT(Profile::get().steps[Profile::Literal]);
+        LEMON_PY_PROFILE_HIT(Profile::get().rule(m.rule));
+        LEMON_PY_PROFILE_TIME(literalTimer, Profile::get().steps[Profile::Literal]);
+        LEMON_PY_PROFILE_TIME(ruleTimer, Profile::get().rule(m.rule));
+        auto tokCode = m.rule->tokCode;
+        auto start = here();
+        advanceTo(m.end);
+        return make_token(tokCode, line, spanFrom(start));
     }
 
-    /** Try all the value patterns to see if one matches, returning it if it does. Returns nullopt if nothing matches. */
-    std::optional<Token> nextValue() {
-        for (auto const& r : valueTypes) {
-            regex_results results;
-            if (std::regex_search(curPos, input.cend(), results, std::get<0>(r), std::regex_constants::match_continuous)) {
-                auto match_iterator = results.begin();
-                if (results.size() > 1) { // skip past the whole match to get a submatch
-                    std::advance(match_iterator, 1);
-                }
-
-                ustring value = (*match_iterator).str();
-
-                advanceBy(results.length()); // advance by length of _entire_ match
-                return make_token(std::get<1>(r), stringTable, value, line);
-            }
-        }
-        return std::nullopt;
+    /** Emit a value token for the given match, extracting the sub-match if the pattern has one. */
+    std::optional<Token> nextValue(Match const& m) {
+        LEMON_PY_PROFILE_ATTEMPT(Profile::get().steps[Profile::Value]);
+        LEMON_PY_PROFILE_HIT(Profile::get().steps[Profile::Value]);
+        LEMON_PY_PROFILE_HIT(Profile::get().rule(m.rule));
+        LEMON_PY_PROFILE_TIME(valueTimer, Profile::get().steps[Profile::Value]);
+        LEMON_PY_PROFILE_TIME(ruleTimer, Profile::get().rule(m.rule));
+        auto [valueBegin, valueEnd] = m.submatch ? m.submatch.value()
+                                    : m.rule->capture ? m.rule->capture->find(curPos, m.end, captureMarks)
+                                    : std::make_tuple(curPos, m.end);
+        auto value = slice(valueBegin, valueEnd);
+
+        auto tokCode = m.rule->tokCode;
+        auto start = here();
+        advanceTo(m.end); // advance by length of _entire_ match
+        return make_input_token(tokCode, value, line, spanFrom(start));
     }
 
 public:
 
-    /** Create a new lexer with the given input, using the given string table. */
-    Lexer(ustring const& inputString, StringTable & stringTable) : input(inputString), curPos(input.cbegin()), stringTable(stringTable), count(0), reachedEnd(false) {}
+    /**
+     * Create a new lexer over the given input, using the given string table. The input is not
+     * copied, and token values refer back into it.
+    */
+    Lexer(ustring_view inputString, StringTable & stringTable) : def(LexerDef::get()), input(inputString), curPos(input.cbegin()), stringTable(stringTable), count(0), reachedEnd(false) {}
 
     /** 
      * Get the next token. Returns a special EOF token (defined by Lemon) when it 
      * reaches end of input, returns nullopt on the next call after emitting EOF.
      * 
+     * If more input might follow (see `setStreamInput`), this also returns nullopt when
+     * the next token can't be decided until more input arrives. Nothing is consumed in
+     * that case, and `next()` can be called again after `setStreamInput`.
+     * 
      * @throw std::runtime_error if there's a error lexing.
      * */
     std::optional<Token> next() {
+        LEMON_PY_PROFILE_ATTEMPT(Profile::get().steps[Profile::Next]);
+        LEMON_PY_PROFILE_TIME(nextTimer, Profile::get().steps[Profile::Next]);
+        auto startPos = curPos;
+        auto startLine = line;
+        auto startLineStart = lineStart;
+        try {
+            return nextToken();
+        }
+        catch (NeedInput const&) {
+            curPos = startPos;
+            line = startLine;
+            lineStart = startLineStart;
+            scanned = false;
+            return std::nullopt;
+        }
+    }
+
+    /**
+     * Make this lexer work on a window of a stream. The window must start at the lexer's current
+     * position in the stream (any consumed input is dropped). If `moreInput` is set, the lexer
+     * won't emit a token that could be changed by input past the end of the window. Token values
+     * are copied, since the window doesn't outlive them.
+    */
+    void setStreamInput(ustring_view window, bool moreInput) {
+        inputOffset += curPos - input.cbegin();
+        input = window;
+        curPos = input.cbegin();
+        copyValues = true;
+        this->moreInput = moreInput;
+        scanned = false;
+    }
+
+    /**
+     * Pick up lexing at `offset` code units into the input, as if everything before it had
+     * already been lexed. `line` is the line number there, and `lineStart` the offset its line
+     * starts at. Token values are copied from here on, since a `Document`'s input is edited
+     * out from under its tokens.
+    */
+    void restartAt(size_t offset, int line, int64_t lineStart) {
+        curPos = input.cbegin() + offset;
+        this->line = line;
+        this->lineStart = lineStart;
+        copyValues = true;
+        reachedEnd = false;
+        scanned = false;
+    }
+
+    /** Get the number of code units of input consumed so far. */
+    size_t consumedCount() const {
+        return curPos - input.cbegin();
+    }
+
+private:
+    /** Get the next token, throwing `NeedInput` if more input is needed first. */
+    std::optional<Token> nextToken() {
         skip();
 
         if (consumedInput()) {
+            if (moreInput) {
+                throw NeedInput {}; // we can't emit EOF until we know there's no more
+            }
             if (reachedEnd) { // second time we return nullopt so we can stop operating
                 return std::nullopt;
             }
             else {
                 reachedEnd = true; // first time, we emit the EOF token
-                return make_token(0, line);
+                return make_token(0, line, here());
             }
         }
         
         if (auto str = nextString()) {
             count++;
+            LEMON_PY_PROFILE_HIT(Profile::get().steps[Profile::Next]);
             return str;
         }
-        else if (auto lit = nextLiteral()) {
-            count++;
-            return lit;
-        }
-        else if (auto value = nextValue()) {
+        else if (auto const& m = scan()) {
             count++;
-            return value;
+            LEMON_PY_PROFILE_HIT(Profile::get().steps[Profile::Next]);
+            if (m->rule->kind == LexRuleKind::Literal) {
+                return nextLiteral(m.value());
+            }
+            return nextValue(m.value());
         }
 
         throw make_error("Cannot lex next character. Not part of any match.");
     };
 
+public:
     /** Get the current line of the current lexer position. */
     int const& getLine() const { return line; }
 
@@ -590,15 +1524,35 @@ public:
     }
 };
 
-/** Forward declaration of codegen'd lexer initialization function. Defined by the BuildLexer.py */
-void _init_lexer();
+/** Production names found in the grammar actions, in order of first appearance. Defined by BuildGrammar.py */
+extern char const* const _production_names[];
+
+/** Number of entries in `_production_names`. Defined by BuildGrammar.py */
+extern size_t const _production_name_count;
+
+/** Hash of the grammar and parser sources, which identifies the trees this parser builds. Defined by BuildGrammar.py */
+extern char const* const _grammar_fingerprint;
+
+SymbolTable::SymbolTable() {
+    auto const& def = LexerDef::get();
+
+    tokenCount = static_cast<int32_t>(def.tokenCount);
+    names.resize(tokenCount);
+    for (int32_t i = 0; i < tokenCount; i++) {
+        if (!def.tokens[i].name) continue;
+        names[i] = toExternal(def.tokenName(i));
+        typeIds.emplace(names[i], i);
+    }
 
-// static storage for lexer.
-PTNode<int> Lexer::literals(0, std::nullopt, std::nullopt, true); // root node.
-decltype(Lexer::skips) Lexer::skips;
-decltype(Lexer::valueTypes) Lexer::valueTypes;
-decltype(Lexer::stringDefs) Lexer::stringDefs;
+    for (size_t i = 0; i < _production_name_count; i++) {
+        literalIds.emplace(_production_names[i], productionId(_production_names[i]));
+    }
+}
 
+SymbolTable& SymbolTable::get() {
+    static SymbolTable table;
+    return table;
+}
 
 //========================== PARSER STATE AND INTERNAL TREE ==============================
 
@@ -630,17 +1584,34 @@ struct GrammarActionNodeHandle {
 
 
 /** Either a production name or a token value. */
-using ParseValue = std::variant<ustring, Token>;
+using ParseValue = std::variant<Production, Token>;
+
+class NodeArena;
+
+/**
+ * The children of a parser-internal parse node. The array is allocated from the
+ * parser's `NodeArena`, and grows by powers of two.
+*/
+struct ChildList {
+    ParseNode** data; ///< child pointers, or nullptr if there's no capacity yet
+    uint32_t size; ///< number of children
+    uint32_t capacity; ///< allocated length of `data`
+
+    ParseNode** begin() const { return data; }
+    ParseNode** end() const { return data + size; }
+    ParseNode*& operator[](size_t index) const { return data[index]; }
+};
 
 /**
  * A parser-internal parse node.
  * 
- * ParseNodes are handled by pointer within the parser.
+ * ParseNodes are handled by pointer within the parser, and live in the parser's `NodeArena`.
 */
 struct ParseNode {
     ParseValue value; ///< the production or token
     int64_t line; ///< line for this node
-    std::vector<ParseNode*> children; ///< pointers to children
+    ChildList children; ///< pointers to children
+    NodeArena *arena; ///< arena holding this node and its children array, or nullptr once the node is dropped
 
     /**
      * Append a sequence of things that, individually, will
@@ -649,17 +1620,17 @@ struct ParseNode {
     template <typename T>
     ParseNode* append(T const& childSeq) {
         for (auto c : childSeq) {
-            children.push_back(c);
+            push_back(c);
         }
 
         return this;
     }
 
     /** Add a node to the end of the children list. */
-    ParseNode* push_back(ParseNode *n) { children.push_back(n); return this; }
+    ParseNode* push_back(ParseNode *n);
 
     /** Add a node to the beginning of the children list. Not typically recommended. */
-    ParseNode* push_front(ParseNode *n) { children.insert(children.begin(), n); return this; }
+    ParseNode* push_front(ParseNode *n);
 
     /** Add a node to the end of the children list. */
     ParseNode* pb(ParseNode *n) { return push_back(n); }
@@ -671,10 +1642,151 @@ struct ParseNode {
     ParseNode* l(int64_t line) { this->line = line; return this; }
 
 private:
-    friend class Parser;
-    friend class std::unique_ptr<ParseNode>;
-    ParseNode() = default;
+    /** Make room for one more child. */
+    void grow();
+};
+
+/**
+ * Storage for parser-internal parse nodes and their child arrays.
+ * 
+ * Everything is bump-allocated out of large blocks, and all of it is freed at once by
+ * `rewind()` (which keeps the blocks for the next parse) or `clear()`; no destructors are
+ * run, so only trivially-destructible types live here. Dropped nodes and outgrown child
+ * arrays are kept on free lists for reuse.
+*/
+class NodeArena {
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    std::vector<std::tuple<std::unique_ptr<char[]>, size_t>> blocks; ///< all allocated memory, and the size of each block
+    size_t currentBlock = 0; ///< index of the block being allocated from
+    char* next = nullptr; ///< next free byte in the current block
+    char* end = nullptr; ///< end of the current block
+    std::vector<ParseNode*> freeNodes; ///< dropped nodes, ready to be reused
+    std::vector<ParseNode**> freeArrays[32]; ///< outgrown child arrays, indexed by log2 of their capacity
+
+    /** Allocate raw, suitably-aligned memory. */
+    void* allocate(size_t size, size_t align) {
+        auto aligned = [align] (char* p) { return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + align - 1) & ~(uintptr_t)(align - 1)); };
+
+        if (!next || aligned(next) + size > end) {
+            if (next) currentBlock++;
+
+            size_t needed = size + align;
+            if (currentBlock == blocks.size() || std::get<1>(blocks[currentBlock]) < needed) { // no block left over from a previous parse fits
+                size_t blockSize = std::max(BlockSize, needed);
+                blocks.emplace(blocks.begin() + currentBlock, std::unique_ptr<char[]>(new char[blockSize]), blockSize);
+            }
+            next = std::get<0>(blocks[currentBlock]).get();
+            end = next + std::get<1>(blocks[currentBlock]);
+        }
+
+        auto retval = aligned(next);
+        next = retval + size;
+        return retval;
+    }
+
+    /** Get log2 of a power of two. */
+    static size_t capacityClass(uint32_t capacity) {
+        size_t retval = 0;
+        while (capacity >>= 1) retval++;
+        return retval;
+    }
+
+public:
+    static_assert(std::is_trivially_destructible_v<ParseNode>, "Arena-allocated nodes must be trivially destructible.");
+
+    ParseNode* touched = nullptr; ///< node most recently made or given a child, see `ReductionLog`
+
+    /** Get a fresh node with no children. */
+    ParseNode* makeNode() {
+        ParseNode* retval;
+        if (!freeNodes.empty()) {
+            retval = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        else {
+            retval = static_cast<ParseNode*>(allocate(sizeof(ParseNode), alignof(ParseNode)));
+        }
+
+        retval->children = ChildList { nullptr, 0, 0 };
+        retval->arena = this;
+        touched = retval;
+        return retval;
+    }
+
+    /**
+     * Return a node to the free list. Its children are not affected. Dropping a node that was
+     * already dropped, or that belongs to another arena, does nothing.
+    */
+    void dropNode(ParseNode* node) {
+        if (node->arena != this) return;
+        node->arena = nullptr; // marks it dropped, until `makeNode()` hands it out again
+        dropArray(node->children.data, node->children.capacity);
+        node->children = ChildList { nullptr, 0, 0 };
+        freeNodes.push_back(node);
+    }
+
+    /** Get a child array with the given power-of-two capacity. */
+    ParseNode** makeArray(uint32_t capacity) {
+        auto & freeList = freeArrays[capacityClass(capacity)];
+        if (!freeList.empty()) {
+            auto retval = freeList.back();
+            freeList.pop_back();
+            return retval;
+        }
+        return static_cast<ParseNode**>(allocate(sizeof(ParseNode*) * capacity, alignof(ParseNode*)));
+    }
+
+    /** Return a child array to the free list. */
+    void dropArray(ParseNode** array, uint32_t capacity) {
+        if (array) {
+            freeArrays[capacityClass(capacity)].push_back(array);
+        }
+    }
+
+    /** Free everything, but keep the memory for reuse. Invalidates every node allocated from this arena. */
+    void rewind() {
+        currentBlock = 0;
+        next = end = nullptr;
+        freeNodes.clear();
+        for (auto & freeList : freeArrays) {
+            freeList.clear();
+        }
+    }
+
+    /** Release all memory. Invalidates every node allocated from this arena. */
+    void clear() {
+        rewind();
+        blocks.clear();
+    }
 };
+
+void ParseNode::grow() {
+    uint32_t newCapacity = children.capacity ? children.capacity * 2 : 2;
+    auto newData = arena->makeArray(newCapacity);
+    std::copy(children.begin(), children.end(), newData);
+    arena->dropArray(children.data, children.capacity);
+
+    children.data = newData;
+    children.capacity = newCapacity;
+}
+
+ParseNode* ParseNode::push_back(ParseNode *n) {
+    if (children.size == children.capacity) grow();
+    children.data[children.size++] = n;
+    arena->touched = this;
+    return this;
+}
+
+ParseNode* ParseNode::push_front(ParseNode *n) {
+    if (children.size == children.capacity) grow();
+    std::copy_backward(children.begin(), children.end(), children.end() + 1);
+    children.data[0] = n;
+    children.size++;
+    arena->touched = this;
+    return this;
+}
+
 /** Used to brace-enclose a list of children for various functions. */
 //using ChildrenPack = std::initializer_list<ParseNode*>;
 using ChildrenPack = GrammarActionNodeHandle::ChildrenPack;
@@ -689,7 +1801,7 @@ GrammarActionNodeHandle GrammarActionNodeHandle::operator[](size_t childIndex) {
 }
 
 GrammarActionNodeHandle& GrammarActionNodeHandle::operator+=(GrammarActionNodeHandle & rhs) {
-    node->children.push_back(rhs);
+    node->push_back(rhs);
     return *this;
 }
 
@@ -697,11 +1809,151 @@ int GrammarActionNodeHandle::operator~() const {
     return node->line;
 }
 
+/**
+ * One reduction from a parse: starting in parser state `stateBelow`, the `length` tokens from
+ * some first token reduced to `symbol`, with the token after them as the look-ahead. It will
+ * do the same for as long as none of those tokens (nor the look-ahead) change, so a reparse
+ * that reaches the first token in the same state can push `node` instead.
+*/
+struct Reduction {
+    ParseNode* node; ///< value of the left-hand side
+    uint32_t length; ///< number of tokens reduced. Lengths, unlike ends, survive edits before the reduction.
+    uint32_t childCount; ///< number of children `node` had then. Later reductions may have added more.
+    uint32_t next; ///< next reduction starting at the same token, or `ReductionLog::None`
+    int32_t symbol; ///< Lemon code of the left-hand side
+    int32_t stateBelow; ///< parser state the first token was shifted onto
+};
+
+/**
+ * The reductions of a `Document`'s parses, chained off the index of the token each one starts
+ * at. The parser feeds it every shift and reduction (see `yyShiftHook`), and it keeps those
+ * that could be reused: the ones covering at least two tokens, whose value is a node the
+ * grammar action made or added to, and whose look-ahead isn't the end of input (reducing the
+ * start symbol sets the root, which a reused subtree wouldn't).
+*/
+struct ReductionLog {
+    static constexpr uint32_t None = std::numeric_limits<uint32_t>::max();
+
+    NodeArena const* arena = nullptr; ///< arena of the parser being logged, to check reduced values against
+    std::vector<Reduction> pool; ///< storage for every chained reduction
+    std::vector<uint32_t> freeSlots; ///< unused entries of `pool`
+    std::vector<uint32_t> heads; ///< first reduction starting at each token, or `None`
+    std::vector<std::pair<uint32_t, Reduction>> made; ///< reductions of the parse in progress, and the tokens they start at
+    std::vector<ParseNode*> tokenNodes; ///< node made from each token, if any, so moving a token can move its node
+    std::vector<ParseNode*> madeTokenNodes; ///< token nodes made by the parse in progress
+    bool tokenNodesExact = true; ///< is every token node in `tokenNodes`? Not once some token has made two.
+
+    std::vector<uint32_t> starts; ///< index of the first token under each parser stack entry
+    ptrdiff_t depth = 0; ///< depth of the top of the parser stack
+    uint32_t position = 0; ///< index of the look-ahead token
+    bool atEnd = false; ///< is the look-ahead the end of input?
+
+    /** Note a shift to the given stack depth. */
+    void shifted(ptrdiff_t depth) {
+        if (starts.size() <= static_cast<size_t>(depth)) starts.resize(depth * 2 + 1);
+        starts[depth] = position;
+        this->depth = depth;
+    }
+
+    /** Note a reduction whose left-hand side ended up at the given stack depth. */
+    void reduced(ptrdiff_t depth, bool empty, int symbol, int stateBelow, void const* value) {
+        if (empty) shifted(depth);
+        this->depth = depth;
+        auto first = starts[depth];
+        if (atEnd || position - first < 2) return;
+
+        ParseNode* node;
+        std::memcpy(&node, value, sizeof(node));
+        if (node != arena->touched) return; // a passed-through value, or not a node at all
+
+        made.emplace_back(first, Reduction { node, position - first, node->children.size, None, symbol, stateBelow });
+    }
+
+    /**
+     * Chain a reduction onto the token it starts at. Chains are kept longest first, and a
+     * reduction to the same symbol over the same tokens replaces the one already there.
+    */
+    void add(uint32_t first, Reduction r) {
+        auto* link = &heads[first];
+        while (*link != None && pool[*link].length > r.length) {
+            link = &pool[*link].next;
+        }
+        for (auto same = *link; same != None && pool[same].length == r.length; same = pool[same].next) {
+            if (pool[same].symbol == r.symbol) {
+                r.next = pool[same].next;
+                pool[same] = r;
+                return;
+            }
+        }
+
+        r.next = *link;
+        uint32_t slot;
+        if (freeSlots.empty()) {
+            slot = static_cast<uint32_t>(pool.size());
+            pool.push_back(r);
+        }
+        else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+            pool[slot] = r;
+        }
+        *link = slot;
+    }
+
+    /** Drop a whole chain. */
+    void freeChain(uint32_t & head) {
+        for (auto r = head; r != None; r = pool[r].next) {
+            freeSlots.push_back(r);
+        }
+        head = None;
+    }
+
+    /** Drop the reductions starting at a token whose look-ahead is at or past `last`. */
+    void purgeReaching(uint32_t first, uint32_t last) {
+        auto & head = heads[first];
+        while (head != None && first + pool[head].length >= last) { // longest first, so they're all up front
+            freeSlots.push_back(head);
+            head = pool[head].next;
+        }
+    }
+
+    /** Number of reductions chained. */
+    size_t size() const {
+        return pool.size() - freeSlots.size();
+    }
+
+    /** Forget everything. */
+    void clear() {
+        pool.clear();
+        freeSlots.clear();
+        heads.clear();
+        made.clear();
+        tokenNodes.clear();
+        madeTokenNodes.clear();
+        tokenNodesExact = true;
+        starts.clear();
+        depth = 0;
+        position = 0;
+        atEnd = false;
+    }
+};
+
 /**
  * Used to implement syntax sugar inside the grammar actions.
 */
 struct GrammarActionParserHandle {
     Parser* parser; ///< pointer to the parent parser
+    ReductionLog* log = nullptr; ///< where to log shifts and reductions, if anywhere
+
+    /** Called by Lemon after a shift. */
+    void shifted(ptrdiff_t depth) {
+        if (log) log->shifted(depth);
+    }
+
+    /** Called by Lemon after a reduction. */
+    void reduced(ptrdiff_t depth, bool empty, int symbol, int stateBelow, void const* value) {
+        if (log) log->reduced(depth, empty, symbol, stateBelow, value);
+    }
 
     /** Passthrough to make_node. */
     GrammarActionNodeHandle operator()(const char* production, ChildrenPack const& children = {}, int64_t line = -1);
@@ -723,12 +1975,23 @@ struct GrammarActionParserHandle {
 class Parser {
     void* lemonParser; ///< opaque poiner to lemon parser
 
-    std::unordered_map<ParseNode*, std::unique_ptr<ParseNode>> allNodes; ///< storage for nodes
+    NodeArena arena; ///< storage for nodes
     StringTable stringTable; ///< string storage
+    SymbolTable & symbols; ///< module symbol table
+    std::unordered_map<std::string_view, int32_t> productionCache; ///< production ids by name, viewing the names in `symbols`. See `make_node`
     Token currentToken; ///< the last token passed from the lexer for parsing 
+#ifdef LEMON_PY_UNICODE_SUPPORT
+    ustring internalInput; ///< input converted to code points, which token values refer into
+#endif
+#if defined(LEMON_PY_UNICODE_SUPPORT) || defined(LEMON_PY_UTF8_SUPPORT)
+    std::string streamPartialChar; ///< bytes of a UTF-8 sequence split across incremental chunks
+#endif
+    std::optional<Lexer> streamLexer; ///< lexer for an incremental parse in progress, see `feed`
+    ustring streamBuffer; ///< input of an incremental parse that hasn't been lexed yet
 
     ParseNode *root = nullptr; ///< root node for the parse tree
     bool successful = false; ///< have we received the successful message from the parser
+    bool keepNodes = false; ///< ignore `drop_node`, because logged reductions may still point at the nodes
     GrammarActionParserHandle thisHandle { this };
 
     void freeParserObject() {
@@ -754,14 +2017,20 @@ class Parser {
      * Reset the parser state. Called internally by `parseString()`, so not necessary to call manually.
     */
     void reset() {
-        allNodes.clear();
+        if (lemonParser) { // this pops anything left on the stack, dropping nodes, so it has to come first
+            LemonPyParseFinalize(lemonParser);
+            LemonPyParseInit(lemonParser);
+        }
+        else {
+            buildParserObject();
+        }
+
+        arena.rewind();
         stringTable.clear();
 
         currentToken = make_token(0, -1);
         root = nullptr;
         successful = false;
-
-        buildParserObject();
     }
 
     /**
@@ -776,9 +2045,7 @@ class Parser {
 public:
 
     /** Create a new parser, allocating lemon parser state. */
-    Parser() : lemonParser(nullptr), allNodes(), stringTable() {
-        _init_lexer();
-    }
+    Parser() : lemonParser(nullptr), arena(), stringTable(), symbols(SymbolTable::get()) {}
 
     /** Deallocate lemon parser state. */
     ~Parser() {
@@ -788,28 +2055,59 @@ public:
 
     /** Make a new node. */
     GrammarActionNodeHandle make_node(ParseValue const& value, ChildrenPack const& children = {}, int64_t line = -1) {
-        auto node = std::unique_ptr<ParseNode>(new ParseNode); // can't use `make_unique` because the constructor's private.
+        auto node = arena.makeNode();
         node->value = value;
         if (std::holds_alternative<Token>(value)) {
             node-> line = std::get<Token>(value).line;
+            if (thisHandle.log) thisHandle.log->madeTokenNodes.push_back(node);
         }
         else {
             node->line = line;
         }
 
-        //node->children.insert(node->children.end(), children);
         node->append(children);
 
-        auto retval = node.get();
-        allNodes.emplace(retval, std::move(node));
+        return node;
+    }
 
-        return retval;
+    /** Make a new nonterminal node, looking up the production's symbol id. */
+    GrammarActionNodeHandle make_node(ustring const& production, ChildrenPack const& children = {}, int64_t line = -1) {
+        return make_node(Production { symbols.productionId(toExternal(production)) }, children, line);
+    }
+
+    /**
+     * Make a new nonterminal node for a production named in a grammar action. The string literals
+     * BuildGrammar.py found in the actions are usually just a pointer lookup. Any other name, which
+     * may be in a buffer the action reuses, is looked up by its contents.
+    */
+    GrammarActionNodeHandle make_node(const char* production, ChildrenPack const& children = {}, int64_t line = -1) {
+        auto id = symbols.findLiteral(production);
+        if (id < 0) {
+            std::string_view name(production);
+            auto it = productionCache.find(name);
+            if (it == productionCache.end()) {
+                id = symbols.productionId(name);
+                it = productionCache.emplace(symbols.name(id), id).first; // keyed by the table's copy, which outlives `production`
+            }
+            id = it->second;
+        }
+        return make_node(Production { id }, children, line);
     }
 
     /** Short for make_node. */
     GrammarActionNodeHandle mn(ParseValue const& value, ChildrenPack const& children = {}, int64_t line = -1) {
         return make_node(value, children, line);
     }
+
+    /** Short for make_node. */
+    GrammarActionNodeHandle mn(ustring const& production, ChildrenPack const& children = {}, int64_t line = -1) {
+        return make_node(production, children, line);
+    }
+
+    /** Short for make_node. */
+    GrammarActionNodeHandle mn(const char* production, ChildrenPack const& children = {}, int64_t line = -1) {
+        return make_node(production, children, line);
+    }
     
     /**
      * Set the root node of the parse tree.
@@ -819,14 +2117,11 @@ public:
     }
 
     /** 
-     * Drop the given node from internal storage. Not strictly necessary, but can keep interim
+     * Return the given node to the arena for reuse. Not strictly necessary, but can keep interim
      * memory usage lower.
      */
     void drop_node(GrammarActionNodeHandle pn) {
-        auto it = allNodes.find(pn);
-        if (it != allNodes.end()) {
-            allNodes.erase(it);
-        }
+        if (!keepNodes) arena.dropNode(pn);
     }
 
     /**
@@ -844,16 +2139,17 @@ public:
     }
 
     /**
-     * Parse the given input string, returning a parse tree on success.
+     * Parse the given input, returning a parse tree on success. The input is lexed in place
+     * without copying, and must outlive the returned tree.
      * 
-     * Invalidates parse nodes returned from any previous invocation of `parseString` on this Parser.
+     * Invalidates parse nodes returned from any previous parse on this Parser.
      * 
      * @throw std::runtime_error on lex or parse error.
     */
-    ParseNode* parseString(std::string const& input) {
+    ParseNode* parseView(ustring_view input) {
         reset(); // allocates the parser object
 
-        Lexer lexer(toInternal(input), stringTable);
+        Lexer lexer(input, stringTable);
 
         while (auto tok = lexer.next()) {
             offerToken(tok.value());
@@ -865,106 +2161,2123 @@ public:
 
         return root;
     }
-};
-
-GrammarActionNodeHandle GrammarActionParserHandle::operator()(const char* production, ChildrenPack const& children, int64_t line) {
-    return parser->make_node(toInternal(production), children, line);
-}
-
-GrammarActionNodeHandle GrammarActionParserHandle::operator()(ustring const& production, ChildrenPack const& children, int64_t line){
-    return parser->make_node(production, children, line);
-}
 
-GrammarActionNodeHandle GrammarActionParserHandle::operator()(Token const& terminal){
-    return parser->make_node(terminal);
-}
+    /**
+     * Parse the given (external, possibly UTF-8) input, returning a parse tree on success. The
+     * input must outlive the returned tree.
+     * 
+     * Invalidates parse nodes returned from any previous parse on this Parser.
+     * 
+     * @throw std::runtime_error on lex or parse error.
+    */
+    ParseNode* parseBuffer(std::string_view input) {
+#ifdef LEMON_PY_UNICODE_SUPPORT
+        internalInput.clear(); // the lexer needs code points, so this is the one copy we can't avoid
+        utf8::utf8to32(input.begin(), input.end(), std::back_inserter(internalInput));
+        return parseView(internalInput);
+#elif defined(LEMON_PY_UTF8_SUPPORT)
+        checkUtf8(input); // the lexer works on the UTF-8 directly, but it has to be valid
+        return parseView(input);
+#else
+        return parseView(input);
+#endif
+    }
 
-GrammarActionNodeHandle GrammarActionParserHandle::operator=(GrammarActionNodeHandle newRoot) {
-    return parser->push_root(newRoot);
-}
+    /**
+     * Parse the given input string, returning a parse tree on success.
+     * 
+     * Invalidates parse nodes returned from any previous invocation of `parseString` on this Parser.
+     * 
+     * @throw std::runtime_error on lex or parse error.
+    */
+    ParseNode* parseString(std::string const& input) {
+        return parseBuffer(input);
+    }
 
-void GrammarActionParserHandle::drop_node(GrammarActionNodeHandle & toDrop) { parser->drop_node(toDrop); }
-void GrammarActionParserHandle::error() { parser->error(); }
-void GrammarActionParserHandle::success() { parser->success(); }
+    /**
+     * Should equal token values copied into the string table share one copy? Values are only
+     * copied when they can't point into the input, as in incremental parses.
+    */
+    void setInternValues(bool on) {
+        stringTable.setInterning(on);
+    }
 
-} // namespace
+    /**
+     * Add a chunk of (external, possibly UTF-8) input to an incremental parse, parsing every token
+     * it completes. Tokens, strings, and skips may be split across chunks. Starts a new parse if
+     * one isn't already in progress, invalidating parse nodes from any previous parse.
+     * 
+     * @throw std::runtime_error on lex or parse error, which also abandons the parse.
+    */
+    void feed(std::string_view chunk) {
+        if (!streamLexer) beginStream();
+
+#ifdef LEMON_PY_UNICODE_SUPPORT
+        streamPartialChar.append(chunk);
+        auto complete = completeUtf8Prefix(streamPartialChar);
+        utf8::utf8to32(streamPartialChar.begin(), streamPartialChar.begin() + complete, std::back_inserter(streamBuffer));
+        streamPartialChar.erase(0, complete);
+#elif defined(LEMON_PY_UTF8_SUPPORT)
+        streamPartialChar.append(chunk);
+        auto complete = completeUtf8Prefix(streamPartialChar);
+        try {
+            checkUtf8(std::string_view(streamPartialChar).substr(0, complete));
+        }
+        catch (...) {
+            streamLexer.reset();
+            throw;
+        }
+        streamBuffer.append(streamPartialChar, 0, complete);
+        streamPartialChar.erase(0, complete);
+#else
+        streamBuffer.append(chunk);
+#endif
+
+        pumpStream(true);
+    }
+
+    /**
+     * Finish an incremental parse, returning a parse tree on success.
+     * 
+     * @throw std::runtime_error on lex or parse error.
+    */
+    ParseNode* finishFeed() {
+        if (!streamLexer) beginStream();
+
+#if defined(LEMON_PY_UNICODE_SUPPORT) || defined(LEMON_PY_UTF8_SUPPORT)
+        if (!streamPartialChar.empty()) {
+            streamLexer.reset();
+            throw std::runtime_error("Input ended inside a UTF-8 sequence.");
+        }
+#endif
+
+        pumpStream(false);
+        streamLexer.reset();
+
+        if (!(successful && root)) {
+            throw std::runtime_error("Lexer reached end of input without parser completing and setting root node.");
+        }
+
+        return root;
+    }
+
+    /**
+     * Log shifts and reductions to the given log, or stop logging if it's nullptr. Nodes are
+     * never dropped while logging, since the log may point at them.
+    */
+    void setLog(ReductionLog* log) {
+        thisHandle.log = log;
+        keepNodes = log != nullptr;
+        if (log) log->arena = &arena;
+    }
+
+    /**
+     * Start a parse fed one token at a time by `parseToken()` and `pushSubtree()`. Unlike other
+     * parses, the nodes and strings of earlier parses are kept, so their subtrees can be reused.
+    */
+    void beginReparse() {
+        if (lemonParser) {
+            LemonPyParseFinalize(lemonParser);
+            LemonPyParseInit(lemonParser);
+        }
+        else {
+            buildParserObject();
+        }
+
+        currentToken = make_token(0, -1);
+        root = nullptr;
+        successful = false;
+    }
+
+    /**
+     * Parse the next token.
+     * 
+     * @throw std::runtime_error on parse error.
+    */
+    void parseToken(Token const& token) {
+        offerToken(token);
+    }
+
+    /**
+     * Run the reductions the given look-ahead token calls for, without parsing the token itself,
+     * and return the parser state left on top of the stack.
+     * 
+     * @throw std::runtime_error on parse error.
+    */
+    int reduceFor(Token const& token) {
+        currentToken = token;
+        return LemonPyParseReduce(lemonParser, token.type, token, thisHandle);
+    }
+
+    /**
+     * Push an already-parsed nonterminal, with the given node as its value, in place of the
+     * tokens it was parsed from.
+    */
+    void pushSubtree(int symbol, ParseNode* node) {
+        GrammarActionNodeHandle value { node };
+        LemonPyParseGoto(lemonParser, symbol, &value, sizeof(value));
+    }
+
+    /**
+     * Finish a parse started with `beginReparse()`, returning the parse tree.
+     * 
+     * @throw std::runtime_error if the parser hasn't completed.
+    */
+    ParseNode* finishReparse() {
+        if (!(successful && root)) {
+            throw std::runtime_error("Lexer reached end of input without parser completing and setting root node.");
+        }
+        return root;
+    }
+
+    /** Get the string table that copied token values are kept in. */
+    StringTable& strings() {
+        return stringTable;
+    }
+
+private:
+    /** Start a new incremental parse. */
+    void beginStream() {
+        reset();
+        streamBuffer.clear();
+#if defined(LEMON_PY_UNICODE_SUPPORT) || defined(LEMON_PY_UTF8_SUPPORT)
+        streamPartialChar.clear();
+#endif
+        streamLexer.emplace(ustring_view(), stringTable);
+    }
+
+    /** Parse every token that can be decided from the buffered input, then drop the consumed input. */
+    void pumpStream(bool moreInput) {
+        try {
+            streamLexer->setStreamInput(streamBuffer, moreInput);
+            while (auto tok = streamLexer->next()) {
+                offerToken(tok.value());
+            }
+            streamBuffer.erase(0, streamLexer->consumedCount());
+        }
+        catch (...) {
+            streamLexer.reset();
+            throw;
+        }
+    }
+};
+
+GrammarActionNodeHandle GrammarActionParserHandle::operator()(const char* production, ChildrenPack const& children, int64_t line) {
+    return parser->make_node(production, children, line);
+}
+
+GrammarActionNodeHandle GrammarActionParserHandle::operator()(ustring const& production, ChildrenPack const& children, int64_t line){
+    return parser->make_node(production, children, line);
+}
+
+GrammarActionNodeHandle GrammarActionParserHandle::operator()(Token const& terminal){
+    return parser->make_node(terminal);
+}
+
+GrammarActionNodeHandle GrammarActionParserHandle::operator=(GrammarActionNodeHandle newRoot) {
+    return parser->push_root(newRoot);
+}
+
+void GrammarActionParserHandle::drop_node(GrammarActionNodeHandle & toDrop) { parser->drop_node(toDrop); }
+void GrammarActionParserHandle::error() { parser->error(); }
+void GrammarActionParserHandle::success() { parser->success(); }
+
+//=============================== INPUT FILES ======================================
+
+/**
+ * A read-only view of an entire file. The file is memory-mapped where the platform supports
+ * it, and otherwise read into memory.
+*/
+class InputFile {
+    char const* data = nullptr; ///< start of the file contents
+    size_t length = 0; ///< length of the file contents
+#ifdef LEMON_PY_MMAP_SUPPORT
+    void* mapping = nullptr; ///< the mapping, or nullptr for an empty file
+#else
+    std::string contents; ///< the file contents
+#endif
+
+public:
+    /**
+     * Open the file at the given path.
+     * 
+     * @throw std::runtime_error if the file cannot be read.
+    */
+    explicit InputFile(std::string const& path) {
+#ifdef LEMON_PY_MMAP_SUPPORT
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open input file: " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat input file: " + path);
+        }
+
+        length = static_cast<size_t>(st.st_size);
+        if (length) {
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map input file: " + path);
+            }
+            madvise(mapping, length, MADV_SEQUENTIAL);
+            data = static_cast<char const*>(mapping);
+        }
+        close(fd); // the mapping stays valid
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot open input file: " + path);
+        }
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = contents.data();
+        length = contents.size();
+#endif
+    }
+
+    InputFile(InputFile const&) = delete;
+    InputFile& operator=(InputFile const&) = delete;
+
+    ~InputFile() {
+#ifdef LEMON_PY_MMAP_SUPPORT
+        if (mapping) munmap(mapping, length);
+#endif
+    }
+
+    /** Get the file contents. */
+    std::string_view view() const {
+        return std::string_view(data, length);
+    }
+};
+
+/**
+ * Hands out the indices of a batch of jobs to a fixed set of workers. Each worker starts with
+ * an equal, contiguous share and takes jobs from its front. A worker whose share runs dry
+ * steals the back half of another's, so a few slow inputs don't leave the other workers idle.
+*/
+class BatchScheduler {
+    struct Share {
+        std::mutex mutex; ///< guards `next` and `end`
+        size_t next = 0; ///< next job to take
+        size_t end = 0; ///< one past the last job in this share
+    };
+
+    std::unique_ptr<Share[]> shares; ///< one share per worker
+    size_t workerCount; ///< number of shares
+
+public:
+    BatchScheduler(size_t jobCount, size_t workerCount) : shares(std::make_unique<Share[]>(workerCount)), workerCount(workerCount) {
+        for (size_t i = 0; i < workerCount; i++) {
+            shares[i].next = jobCount * i / workerCount;
+            shares[i].end = jobCount * (i + 1) / workerCount;
+        }
+    }
+
+    /**
+     * Take the next job for `worker`, stealing if its own share is empty. Returns false
+     * once every share is empty.
+    */
+    bool take(size_t worker, size_t & job) {
+        Share & own = shares[worker];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.next < own.end) {
+                job = own.next++;
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < workerCount; i++) {
+            Share & victim = shares[(worker + i) % workerCount];
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                size_t remaining = victim.end - victim.next;
+                if (!remaining) continue;
+
+                end = victim.end;
+                begin = end - (remaining + 1) / 2;
+                victim.end = begin;
+            }
+
+            std::lock_guard<std::mutex> lock(own.mutex);
+            job = begin;
+            own.next = begin + 1;
+            own.end = end;
+            return true;
+        }
+
+        return false;
+    }
+};
+
+} // namespace
 
 
 //========================= PUBLIC API IMPLEMENTATIONS ================================
 
-#include <ParseNode.hpp>
+#include <ParseNode.hpp>
+
+namespace parser {
+
+
+/**
+ * Builds dot output in a reusable buffer, which is either returned whole or flushed to a file
+ * whenever it fills up.
+*/
+class DotWriter {
+    static constexpr size_t FLUSH_SIZE = 1 << 16; ///< flush to the file once this much is pending
+
+    std::string buf; ///< pending output
+    std::FILE* file; ///< where to flush, or nullptr to keep everything in `buf`
+
+public:
+    explicit DotWriter(std::FILE* file = nullptr) : buf(), file(file) {
+        if (file) buf.reserve(FLUSH_SIZE * 2);
+    }
+
+    void put(std::string_view s) {
+        buf.append(s);
+    }
+
+    void putInt(int64_t v) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), v);
+        buf.append(digits, result.ptr);
+    }
+
+    void putSanitized(std::string_view s) {
+        sanitize_into(buf, s);
+    }
+
+    /** Write out the pending output, if there's a file and enough of it. */
+    void maybeFlush() {
+        if (file && buf.size() >= FLUSH_SIZE) flush();
+    }
+
+    /**
+     * Write out all pending output to the file.
+     * 
+     * @throw std::runtime_error if the write fails.
+    */
+    void flush() {
+        if (!buf.empty() && std::fwrite(buf.data(), 1, buf.size(), file) != buf.size()) {
+            throw std::runtime_error("Cannot write dot output.");
+        }
+        buf.clear();
+    }
+
+    /** Take the output built up so far, if not writing to a file. */
+    std::string take() {
+        return std::move(buf);
+    }
+
+    /** Write the graph header. */
+    void begin() {
+        put("digraph \"AST\" { \n");
+        put("node [shape=record, style=filled];\n\n");
+    }
+
+    /** Write the graph footer. */
+    void end() {
+        put("\n}\n");
+    }
+
+    /** Write a node and its children, in pre-order. */
+    void tree(ParseNode const& root, ParseNode const* parent) {
+        std::vector<std::pair<ParseNode const*, ParseNode const*>> stack { {&root, parent} }; // node, parent
+
+        while (!stack.empty()) {
+            auto [n, p] = stack.back();
+            stack.pop_back();
+
+            put("node [shape=record, label=\"{<f0>line:");
+            putInt(n->line);
+            if (n->productionId >= 0) {
+                put(" | <f1> ");
+                putSanitized(symbol_name(n->productionId));
+                put(" }\"] ");
+            }
+            else {
+                put(" | { <f1> ");
+                putSanitized(symbol_name(n->typeId));
+                put(" | <f2> ");
+                putSanitized(n->value.value());
+                put("}}\"] ");
+            }
+            putInt(n->id);
+            put(";\n");
+
+            if (p) {
+                putInt(p->id);
+                put(" -> ");
+                putInt(n->id);
+                put(";\n");
+            }
+            maybeFlush();
+
+            for (auto c = n->children.rbegin(); c != n->children.rend(); ++c) {
+                stack.emplace_back(&*c, n);
+            }
+        }
+    }
+};
+
+void ParseNode::dotify(std::stringstream & out, const ParseNode * parent) const {
+    DotWriter writer;
+    writer.tree(*this, parent);
+    out << writer.take();
+}
+
+/**
+ * Create a complete dot graph, rooted at the given ParseNode.
+*/
+std::string dotify(ParseNode const& pn) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    DotWriter writer;
+    writer.begin();
+    writer.tree(pn, nullptr);
+    writer.end();
+
+    return writer.take();
+}
+
+/**
+ * Write a complete dot graph, rooted at the given ParseNode, to a file.
+*/
+void dotify_file(ParseNode const& pn, std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(path.c_str(), "wb"), &std::fclose);
+    if (!file) {
+        throw std::runtime_error("Cannot open dot output file: " + path);
+    }
+
+    DotWriter writer(file.get());
+    writer.begin();
+    writer.tree(pn, nullptr);
+    writer.end();
+    writer.flush();
+
+    if (std::fclose(file.release()) != 0) {
+        throw std::runtime_error("Cannot write dot output file: " + path);
+    }
+}
+
+/**
+ * Convert a span from the internal representation.
+*/
+SourceSpan uplift_span(_parser_impl::Span const& span) {
+    return SourceSpan { span.begin, span.end, span.beginLine, span.beginColumn, span.endLine, span.endColumn };
+}
+
+/**
+ * Copy the fields of one internal node (but not its children) into an external node.
+*/
+static void uplift_fields(ParseNode & out, _parser_impl::ParseNode const* alien) {
+    using _parser_impl::toExternal;
+    if (std::holds_alternative<_parser_impl::Token>(alien->value)) {
+        auto const& tok = std::get<_parser_impl::Token>(alien->value);
+        out.typeId = tok.type;
+        out.value = toExternal(tok.valueView());
+        out.span = uplift_span(tok.span);
+    }
+    else {
+        out.productionId = std::get<_parser_impl::Production>(alien->value).symbol;
+    }
+    out.line = alien->line;
+}
+
+/**
+ * Uplift a node from the internal pointer-based representation into the 
+ * external value-semantics representation.
+ * 
+ * This walks an explicit stack rather than recursing, so trees of any depth can be uplifted.
+ * Ids are assigned in pre-order.
+*/
+ParseNode uplift_node(_parser_impl::ParseNode const* alien, int & idCounter) {
+    struct Frame {
+        ParseNode* out;
+        _parser_impl::ParseNode const* in;
+        uint32_t next; ///< index of the next child to uplift
+    };
+
+    ParseNode retval;
+    retval.id = idCounter++;
+    uplift_fields(retval, alien);
+    retval.children.reserve(alien->children.size); // never grows again, so pointers into it stay valid
+
+    std::vector<Frame> stack { {&retval, alien, 0} };
+    while (!stack.empty()) {
+        Frame & top = stack.back();
+        if (top.next < top.in->children.size) {
+            auto in = top.in->children[top.next++];
+            ParseNode & child = top.out->children.emplace_back();
+            child.id = idCounter++;
+            uplift_fields(child, in);
+            child.children.reserve(in->children.size);
+            stack.push_back({&child, in, 0}); // invalidates `top`
+        }
+        else {
+            ParseNode* done = top.out;
+            stack.pop_back();
+            if (!stack.empty() && stack.back().out->productionId >= 0) {
+                auto & parent = *stack.back().out;
+                parent.span = parent.span.merge(done->span);
+            }
+        }
+    }
+
+    return retval;
+}
+
+/**
+ * Uplift a node from the internal poiner-based representation into the 
+ * external value-semantics representation.
+*/
+ParseNode uplift_node(_parser_impl::ParseNode const* alien) {
+    int idCounter = 0;
+    return uplift_node(alien, idCounter);
+}
+
+/**
+ * The arrays behind a `FlatTree` built in memory.
+*/
+struct FlatStorage {
+    std::vector<FlatNode> nodes;
+    std::string pool;
+};
+
+/**
+ * Make a `FlatTree` viewing, and sharing ownership of, the given arrays.
+*/
+static FlatTree make_flat_tree(std::shared_ptr<FlatStorage> storage) {
+    FlatTree retval;
+    retval.nodes = ArrayView<FlatNode>(storage->nodes.data(), storage->nodes.size());
+    retval.pool = storage->pool;
+    retval.storage = std::move(storage);
+    return retval;
+}
+
+/**
+ * Flatten a tree from the internal pointer-based representation into a `FlatTree`.
+*/
+FlatTree flatten_node(_parser_impl::ParseNode* root) {
+    using namespace _parser_impl;
+    auto storage = std::make_shared<FlatStorage>();
+    FlatStorage & retval = *storage;
+
+    auto symbolFor = [] (ParseValue const& value) {
+        if (auto tok = std::get_if<Token>(&value)) {
+            return static_cast<uint32_t>(tok->type);
+        }
+        return static_cast<uint32_t>(std::get<Production>(value).symbol);
+    };
+
+    struct Frame {
+        _parser_impl::ParseNode* node; ///< node being visited
+        uint32_t nextChild; ///< next child of `node` to visit
+        uint32_t index; ///< index of `node` in the output
+    };
+    std::vector<Frame> stack;
+
+    auto visit = [&retval, &stack, &symbolFor] (_parser_impl::ParseNode* n) {
+        FlatNode flat { 0, n->line, symbolFor(n->value), 0, n->children.size, 1, SourceSpan() };
+        if (auto tok = std::get_if<Token>(&n->value)) {
+            auto value = toExternal(tok->valueView());
+            flat.valueOffset = retval.pool.size();
+            flat.valueLength = static_cast<uint32_t>(value.size());
+            retval.pool += value;
+            flat.span = uplift_span(tok->span);
+        }
+
+        stack.push_back(Frame { n, 0, static_cast<uint32_t>(retval.nodes.size()) });
+        retval.nodes.push_back(flat);
+    };
+
+    visit(root);
+    while (!stack.empty()) {
+        auto & top = stack.back();
+        if (top.nextChild < top.node->children.size) {
+            auto child = top.node->children[top.nextChild++];
+            visit(child);
+        }
+        else {
+            auto & finished = retval.nodes[top.index];
+            finished.subtreeSize = static_cast<uint32_t>(retval.nodes.size() - top.index);
+            stack.pop_back();
+
+            if (!stack.empty() && !std::holds_alternative<Token>(stack.back().node->value)) { // productions cover their children
+                auto & parent = retval.nodes[stack.back().index];
+                parent.span = parent.span.merge(finished.span);
+            }
+        }
+    }
+
+    return make_flat_tree(std::move(storage));
+}
+
+/**
+ * Convert a value-typed parse tree into a flat one.
+*/
+FlatTree flatten(ParseNode const& root) {
+    auto storage = std::make_shared<FlatStorage>();
+    FlatStorage & retval = *storage;
+
+    struct Frame {
+        ParseNode const* node; ///< node being visited
+        uint32_t nextChild; ///< next child of `node` to visit
+        uint32_t index; ///< index of `node` in the output
+    };
+    std::vector<Frame> stack;
+
+    auto visit = [&retval, &stack] (ParseNode const& n) {
+        auto symbol = static_cast<uint32_t>(n.productionId >= 0 ? n.productionId : n.typeId);
+        FlatNode flat { 0, n.line, symbol, 0, static_cast<uint32_t>(n.children.size()), 1, n.span };
+        if (n.value) {
+            flat.valueOffset = retval.pool.size();
+            flat.valueLength = static_cast<uint32_t>(n.value->size());
+            retval.pool += *n.value;
+        }
+
+        stack.push_back(Frame { &n, 0, static_cast<uint32_t>(retval.nodes.size()) });
+        retval.nodes.push_back(flat);
+    };
+
+    visit(root);
+    while (!stack.empty()) {
+        auto & top = stack.back();
+        if (top.nextChild < top.node->children.size()) {
+            visit(top.node->children[top.nextChild++]);
+        }
+        else {
+            retval.nodes[top.index].subtreeSize = static_cast<uint32_t>(retval.nodes.size() - top.index);
+            stack.pop_back();
+        }
+    }
+
+    return make_flat_tree(std::move(storage));
+}
+
+/**
+ * The header of a file written by `FlatTree::save()`. It's followed by the symbol names (each
+ * NUL-terminated, with empty names for unused token codes), padding up to a multiple of 8 bytes,
+ * the node table, and the string pool.
+*/
+struct SavedTreeHeader {
+    static constexpr char MAGIC[8] = { 'L', 'E', 'M', 'O', 'N', 'P', 'Y', 'T' };
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304; ///< reads differently if saved on a machine of the other endianness
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeSize; ///< `sizeof(FlatNode)` when saved
+    uint32_t tokenCount; ///< symbol ids below this are tokens, and the rest productions
+    uint32_t symbolCount;
+    uint32_t reserved;
+    uint64_t symbolsSize; ///< bytes of symbol names, including their NULs
+    uint64_t nodeCount;
+    uint64_t poolSize;
+};
+
+static size_t pad8(size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * Save a tree to a file. See `FlatTree::save()`.
+*/
+static void save_flat_tree(FlatTree const& tree, std::string const& path) {
+    auto const& nodes = tree.nodes;
+    auto const& pool = tree.pool;
+    auto & symbols = _parser_impl::SymbolTable::get();
+    int32_t symbolCount = 0;
+    for (auto const& n : nodes) { // runtime productions may be added while we work, so only save as far as we use
+        symbolCount = std::max(symbolCount, static_cast<int32_t>(n.symbol) + 1);
+    }
+
+    std::string names;
+    for (int32_t i = 0; i < symbolCount; i++) {
+        names += symbols.name(i);
+        names += '\0';
+    }
+    names.resize(pad8(sizeof(SavedTreeHeader) + names.size()) - sizeof(SavedTreeHeader), '\0');
+
+    SavedTreeHeader header {};
+    std::memcpy(header.magic, SavedTreeHeader::MAGIC, sizeof(header.magic));
+    header.version = SavedTreeHeader::VERSION;
+    header.byteOrder = SavedTreeHeader::ENDIAN_MARK;
+    header.nodeSize = sizeof(FlatNode);
+    header.tokenCount = 0;
+    while (static_cast<int32_t>(header.tokenCount) < symbolCount && symbols.isTerminal(header.tokenCount)) header.tokenCount++;
+    header.symbolCount = static_cast<uint32_t>(symbolCount);
+    header.symbolsSize = names.size();
+    header.nodeCount = nodes.size();
+    header.poolSize = pool.size();
+
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(path.c_str(), "wb"), &std::fclose);
+    if (!file) {
+        throw std::runtime_error("Cannot open tree file for writing: " + path);
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file.get()) == 1
+        && std::fwrite(names.data(), 1, names.size(), file.get()) == names.size()
+        && std::fwrite(nodes.data(), sizeof(FlatNode), nodes.size(), file.get()) == nodes.size()
+        && std::fwrite(pool.data(), 1, pool.size(), file.get()) == pool.size();
+    if (std::fclose(file.release()) != 0 || !ok) {
+        throw std::runtime_error("Cannot write tree file: " + path);
+    }
+}
+
+/**
+ * Load a tree saved by `save_flat_tree()`. See `FlatTree::load()`.
+*/
+static FlatTree load_flat_tree(std::string const& path) {
+    auto file = std::make_shared<_parser_impl::InputFile>(path);
+    std::string_view bytes = file->view();
+    auto fail = [&path] (const char* why) {
+        return std::runtime_error("Cannot load tree file " + path + ": " + why);
+    };
+
+    SavedTreeHeader header;
+    if (bytes.size() < sizeof(header)) throw fail("too short.");
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::memcmp(header.magic, SavedTreeHeader::MAGIC, sizeof(header.magic)) != 0) throw fail("not a saved tree.");
+    if (header.version != SavedTreeHeader::VERSION) throw fail("unsupported version.");
+    if (header.byteOrder != SavedTreeHeader::ENDIAN_MARK || header.nodeSize != sizeof(FlatNode)) throw fail("saved on an incompatible platform.");
+
+    size_t remaining = bytes.size() - sizeof(header);
+    if (header.symbolsSize > remaining || header.symbolsSize % 8 != (8 - sizeof(header) % 8) % 8) throw fail("truncated symbol table.");
+    remaining -= header.symbolsSize;
+    if (header.nodeCount > remaining / sizeof(FlatNode)) throw fail("truncated node table.");
+    remaining -= header.nodeCount * sizeof(FlatNode);
+    if (header.poolSize != remaining) throw fail("truncated string pool.");
+
+    // match the saved symbols up with ours
+    auto & symbols = _parser_impl::SymbolTable::get();
+    std::vector<uint32_t> symbolMap(header.symbolCount);
+    bool identity = true;
+    std::string_view names = bytes.substr(sizeof(header), header.symbolsSize);
+    for (uint32_t i = 0; i < header.symbolCount; i++) {
+        auto end = names.find('\0');
+        if (end == std::string_view::npos) throw fail("truncated symbol table.");
+        std::string name(names.substr(0, end));
+        names.remove_prefix(end + 1);
+
+        int32_t id = static_cast<int32_t>(i);
+        if (name.empty()) {
+            // an unused token code, which no node refers to
+        }
+        else if (i < header.tokenCount) {
+            id = symbols.findType(name);
+            if (id < 0) throw std::runtime_error("Cannot load tree file " + path + ": unknown token `" + name + "`.");
+        }
+        else {
+            id = symbols.productionId(name);
+        }
+        symbolMap[i] = static_cast<uint32_t>(id);
+        identity = identity && id == static_cast<int32_t>(i);
+    }
+
+    FlatTree retval;
+    auto nodeData = reinterpret_cast<FlatNode const*>(bytes.data() + sizeof(header) + header.symbolsSize);
+    retval.pool = bytes.substr(bytes.size() - header.poolSize);
+
+    if (identity) {
+        retval.nodes = ArrayView<FlatNode>(nodeData, header.nodeCount);
+        retval.storage = std::move(file);
+        return retval;
+    }
+
+    // some ids differ, so translate a copy of the node table
+    struct TranslatedStorage {
+        std::shared_ptr<_parser_impl::InputFile> file;
+        std::vector<FlatNode> nodes;
+    };
+    auto storage = std::make_shared<TranslatedStorage>();
+    storage->file = std::move(file);
+    storage->nodes.assign(nodeData, nodeData + header.nodeCount);
+    for (auto & n : storage->nodes) {
+        if (n.symbol >= symbolMap.size()) throw fail("symbol id out of range.");
+        n.symbol = symbolMap[n.symbol];
+    }
+    retval.nodes = ArrayView<FlatNode>(storage->nodes.data(), storage->nodes.size());
+    retval.storage = std::move(storage);
+    return retval;
+}
+
+void FlatTree::save(std::string const& path) const {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    save_flat_tree(*this, path);
+}
+
+FlatTree FlatTree::load(std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    return load_flat_tree(path);
+}
+
+/**
+ * Uplift a flat tree into the value-semantics representation. Ids are the flat pre-order indices.
+*/
+static ParseNode uplift_flat(FlatTree const& tree) {
+    auto fields = [&tree] (ParseNode & out, uint32_t index) {
+        auto const& flat = tree.nodes[index];
+        if (symbol_is_terminal(static_cast<int32_t>(flat.symbol))) {
+            out.typeId = static_cast<int32_t>(flat.symbol);
+            out.value = std::string(tree.pool.substr(flat.valueOffset, flat.valueLength));
+        }
+        else {
+            out.productionId = static_cast<int32_t>(flat.symbol);
+        }
+        out.line = flat.line;
+        out.span = flat.span;
+        out.id = static_cast<int>(index);
+        out.children.reserve(flat.childCount); // never grows again, so pointers into it stay valid
+    };
+
+    struct Frame {
+        ParseNode* out;
+        uint32_t index; ///< index of `out` in the flat tree
+        uint32_t next; ///< index of the next child to uplift, or the end of the subtree
+    };
+
+    ParseNode retval;
+    if (tree.nodes.empty()) return retval;
+    fields(retval, 0);
+
+    std::vector<Frame> stack { {&retval, 0, 1} };
+    while (!stack.empty()) {
+        Frame & top = stack.back();
+        if (top.next < top.index + tree.nodes[top.index].subtreeSize) {
+            uint32_t child = top.next;
+            top.next += tree.nodes[child].subtreeSize;
+            ParseNode & out = top.out->children.emplace_back();
+            fields(out, child);
+            stack.push_back({&out, child, child + 1}); // invalidates `top`
+        }
+        else {
+            stack.pop_back();
+        }
+    }
+
+    return retval;
+}
+
+/**
+ * Get the name of a production or token symbol id.
+ * 
+ * @throw std::runtime_error if the id is out of range.
+*/
+std::string const& symbol_name(int32_t id) {
+    return _parser_impl::SymbolTable::get().name(id);
+}
+
+/** Is the given symbol id a token type? */
+bool symbol_is_terminal(int32_t id) {
+    return _parser_impl::SymbolTable::get().isTerminal(id);
+}
+
+/** Get the symbol id of a production name, or -1 if there's no such production. */
+int32_t production_id(std::string const& name) {
+    return _parser_impl::SymbolTable::get().findProduction(name);
+}
+
+/** Get the symbol id of a token name, or -1 if there's no such token. */
+int32_t type_id(std::string const& name) {
+    return _parser_impl::SymbolTable::get().findType(name);
+}
+
+/**
+ * Get the fingerprint of the grammar this parser was built from.
+*/
+std::string const& grammar_fingerprint() {
+    static const std::string fingerprint = _parser_impl::_grammar_fingerprint;
+    return fingerprint;
+}
+
+/**
+ * Parse a string and return a value-semantics parse node.
+ * 
+ * @throw std::runtime_error if there is a lex or parse error.
+*/
+ParseNode parse_string(std::string const& input) {
+    return parse_buffer(input.data(), input.size());
+}
+
+/**
+ * Parse a buffer in place and return a value-semantics parse node.
+ * 
+ * @throw std::runtime_error if there is a lex or parse error.
+*/
+ParseNode parse_buffer(const char* data, size_t length) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    using namespace _parser_impl;
+    Parser p;
+    return uplift_node(p.parseBuffer(std::string_view(data, length)));
+}
+
+/**
+ * Memory-map a file, parse it in place, and return a value-semantics parse node.
+ * 
+ * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+*/
+ParseNode parse_file(std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    using namespace _parser_impl;
+    InputFile file(path);
+    Parser p;
+    return uplift_node(p.parseBuffer(file.view()));
+}
+
+/**
+ * Parse a string and return a flat parse tree.
+ * 
+ * @throw std::runtime_error if there is a lex or parse error.
+*/
+FlatTree parse_flat(std::string const& input) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    using namespace _parser_impl;
+    Parser p;
+    return flatten_node(p.parseBuffer(input));
+}
+
+/**
+ * Memory-map a file, parse it in place, and return a flat parse tree.
+ * 
+ * @throw std::runtime_error if the file cannot be read, or there is a lex or parse error.
+*/
+FlatTree parse_flat_file(std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    using namespace _parser_impl;
+    InputFile file(path);
+    Parser p;
+    return flatten_node(p.parseBuffer(file.view()));
+}
+
+/**
+ * Parse many inputs in parallel, returning a result per input in input order.
+*/
+std::vector<BatchResult> parse_batch(std::vector<BatchInput> const& inputs, size_t threads) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    using namespace _parser_impl;
+    std::vector<BatchResult> results(inputs.size());
+    if (inputs.empty()) return results;
+
+    if (!threads) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, inputs.size());
+
+    BatchScheduler scheduler(inputs.size(), threads);
+
+    auto work = [&](size_t worker) {
+        std::optional<Parser> p; // created on first use, so a worker that finds no jobs costs nothing
+        size_t job;
+        while (scheduler.take(worker, job)) {
+            try {
+                std::optional<InputFile> file;
+                std::string_view text = inputs[job].data;
+                if (inputs[job].isFile) {
+                    file.emplace(std::string(text));
+                    text = file->view();
+                }
+
+                if (!p) p.emplace();
+                results[job].tree = uplift_node(p->parseBuffer(text));
+            }
+            catch (std::exception const& e) {
+                results[job].error = e.what();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    try {
+        for (size_t i = 1; i < threads; i++) {
+            workers.emplace_back(work, i);
+        }
+    }
+    catch (std::system_error const&) {
+        // out of threads. the running workers will steal the unstarted workers' shares.
+    }
+
+    work(0);
+
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    return results;
+}
+
+/**
+ * Parse many strings in parallel, returning a result per input in input order.
+*/
+std::vector<BatchResult> parse_batch(std::vector<std::string> const& inputs, size_t threads) {
+    std::vector<BatchInput> batch;
+    batch.reserve(inputs.size());
+    for (auto const& input : inputs) {
+        batch.push_back({input, false});
+    }
+    return parse_batch(batch, threads);
+}
+
+/** Reusable parser state. */
+struct ParserContext::Impl {
+    _parser_impl::Parser parser;
+};
+
+ParserContext::ParserContext() : impl(std::make_unique<Impl>()) {}
+ParserContext::ParserContext(ParserContext &&) noexcept = default;
+ParserContext& ParserContext::operator=(ParserContext &&) noexcept = default;
+ParserContext::~ParserContext() = default;
+
+ParseNode ParserContext::parse(std::string const& input) {
+    return parseBuffer(input.data(), input.size());
+}
+
+ParseNode ParserContext::parseBuffer(const char* data, size_t length) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    return uplift_node(impl->parser.parseBuffer(std::string_view(data, length)));
+}
+
+ParseNode ParserContext::parseFile(std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    _parser_impl::InputFile file(path);
+    return uplift_node(impl->parser.parseBuffer(file.view()));
+}
+
+FlatTree ParserContext::parseFlat(std::string const& input) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    return flatten_node(impl->parser.parseBuffer(input));
+}
+
+/** Incremental parser state. */
+struct IncrementalParser::Impl {
+    _parser_impl::Parser parser;
+};
+
+IncrementalParser::IncrementalParser(bool internValues) : impl(std::make_unique<Impl>()) {
+    impl->parser.setInternValues(internValues);
+}
+
+IncrementalParser::IncrementalParser(IncrementalParser &&) noexcept = default;
+IncrementalParser& IncrementalParser::operator=(IncrementalParser &&) noexcept = default;
+IncrementalParser::~IncrementalParser() = default;
+
+void IncrementalParser::feed(std::string_view chunk) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    impl->parser.feed(chunk);
+}
+
+ParseNode IncrementalParser::finish() {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    return uplift_node(impl->parser.finishFeed());
+}
+
+FlatTree IncrementalParser::finishFlat() {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    return flatten_node(impl->parser.finishFeed());
+}
+
+/**
+ * Hash input bytes for the parse cache, with MurmurHash3 (the x64, 128-bit variant).
+*/
+static std::array<uint64_t, 2> hash_input(std::string_view data) {
+    auto rotl = [] (uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto load = [] (const char* p) { uint64_t k; std::memcpy(&k, p, sizeof(k)); return k; };
+    auto fmix = [] (uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    };
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    uint64_t h1 = 0, h2 = 0;
+    size_t blocks = data.size() / 16;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t k1 = load(data.data() + i * 16);
+        uint64_t k2 = load(data.data() + i * 16 + 8);
+
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    uint64_t k1 = 0, k2 = 0;
+    auto tail = reinterpret_cast<const unsigned char*>(data.data() + blocks * 16);
+    for (size_t i = data.size() % 16; i-- > 0;) {
+        if (i >= 8) k2 ^= static_cast<uint64_t>(tail[i]) << ((i - 8) * 8);
+        else k1 ^= static_cast<uint64_t>(tail[i]) << (i * 8);
+    }
+    k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2; // these are no-ops for a zero tail
+    k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+
+    h1 ^= data.size();
+    h2 ^= data.size();
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    return { h1, h2 };
+}
+
+/** Parse cache state. */
+struct ParseCache::Impl {
+    /** Identifies an input by its hash and length. */
+    struct Key {
+        std::array<uint64_t, 2> hash;
+        uint64_t length;
+
+        bool operator==(Key const& o) const { return hash == o.hash && length == o.length; }
+    };
+
+    struct KeyHash {
+        size_t operator()(Key const& k) const { return static_cast<size_t>(k.hash[0]); }
+    };
+
+    struct Entry {
+        Key key;
+        FlatTree tree;
+        size_t bytes; ///< size of `tree`'s arrays
+    };
+
+    size_t maxBytes; ///< evict trees once they take up more than this
+    std::string directory; ///< where trees are saved, or empty
+
+    std::mutex mutex; ///< guards everything below
+    std::list<Entry> entries; ///< cached trees, most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index; ///< entries by key
+    std::vector<std::unique_ptr<_parser_impl::Parser>> idleParsers; ///< parsers for misses, kept for reuse
+    ParseCacheStats stats;
+
+    /** Get the file a tree would be saved to. */
+    std::string pathFor(Key const& key) const {
+        char name[128];
+        snprintf(name, sizeof(name), "%s-%016llx%016llx-%llx.lpt", _parser_impl::_grammar_fingerprint,
+            static_cast<unsigned long long>(key.hash[0]), static_cast<unsigned long long>(key.hash[1]), static_cast<unsigned long long>(key.length));
+        return directory + "/" + name;
+    }
+
+    /** Add a tree as the most recently used, evicting the least recently used over the limit. Call with `mutex` held. */
+    void insert(Key const& key, FlatTree const& tree) {
+        if (index.count(key)) return; // another thread got there first
+
+        size_t bytes = tree.nodes.size() * sizeof(FlatNode) + tree.pool.size();
+        entries.push_front(Entry { key, tree, bytes });
+        index.emplace(key, entries.begin());
+        stats.entries++;
+        stats.bytes += bytes;
+
+        while (stats.bytes > maxBytes && !entries.empty()) {
+            auto const& oldest = entries.back();
+            stats.entries--;
+            stats.bytes -= oldest.bytes;
+            stats.evictions++;
+            index.erase(oldest.key);
+            entries.pop_back();
+        }
+    }
+
+    /** Parse an input, with a parser borrowed from the idle list. */
+    FlatTree parseFresh(std::string_view input) {
+        std::unique_ptr<_parser_impl::Parser> parser;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!idleParsers.empty()) {
+                parser = std::move(idleParsers.back());
+                idleParsers.pop_back();
+            }
+        }
+        if (!parser) parser = std::make_unique<_parser_impl::Parser>();
+
+        FlatTree retval = flatten_node(parser->parseBuffer(input));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        idleParsers.push_back(std::move(parser));
+        return retval;
+    }
+
+    /** Get the tree for an input from memory, from the directory, or by parsing it. */
+    FlatTree get(std::string_view input) {
+        Key key { hash_input(input), input.size() };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                entries.splice(entries.begin(), entries, it->second);
+                stats.hits++;
+                return it->second->tree;
+            }
+        }
+
+        std::string path = directory.empty() ? std::string() : pathFor(key);
+        if (!path.empty()) {
+            std::optional<FlatTree> saved;
+            try {
+                saved = load_flat_tree(path);
+            }
+            catch (std::runtime_error const&) {} // not saved yet, or unreadable
+
+            if (saved) {
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.diskHits++;
+                insert(key, *saved);
+                return *saved;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.misses++;
+        }
+        FlatTree tree = parseFresh(input);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            insert(key, tree);
+        }
+
+        if (!path.empty()) {
+            // write under a unique name and rename, so readers never see part of a file
+            auto unique = std::hash<std::thread::id>()(std::this_thread::get_id()) ^ static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+            std::string temp = path + "." + std::to_string(unique) + ".tmp";
+            try {
+                save_flat_tree(tree, temp);
+                if (std::rename(temp.c_str(), path.c_str()) != 0) std::remove(temp.c_str());
+            }
+            catch (std::runtime_error const&) {
+                std::remove(temp.c_str());
+            }
+        }
+
+        return tree;
+    }
+};
+
+ParseCache::ParseCache(size_t maxBytes, std::string const& directory) : impl(std::make_unique<Impl>()) {
+    impl->maxBytes = maxBytes;
+    impl->directory = directory;
+    if (!directory.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        if (ec) {
+            throw std::runtime_error("Cannot create parse cache directory " + directory + ": " + ec.message());
+        }
+    }
+}
+
+ParseCache::ParseCache(ParseCache &&) noexcept = default;
+ParseCache& ParseCache::operator=(ParseCache &&) noexcept = default;
+ParseCache::~ParseCache() = default;
+
+ParseNode ParseCache::parse(std::string const& input) {
+    return parseBuffer(input.data(), input.size());
+}
+
+ParseNode ParseCache::parseBuffer(const char* data, size_t length) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    return uplift_flat(impl->get(std::string_view(data, length)));
+}
 
-namespace parser {
+ParseNode ParseCache::parseFile(std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
 
+    _parser_impl::InputFile file(path);
+    return uplift_flat(impl->get(file.view()));
+}
 
-/**
- * Create a complete dot graph, rooted at the given ParseNode.
-*/
-std::string dotify(ParseNode const& pn) {
+FlatTree ParseCache::parseFlat(std::string const& input) {
 #ifndef LEMON_PY_SUPPRESS_PYTHON
     py::gil_scoped_release _release_GIL;
 #endif
-    
-    std::stringstream out;
 
-    out << "digraph \"AST\" { \n";
-	out << "node [shape=record, style=filled];\n\n";
+    return impl->get(input);
+}
+
+FlatTree ParseCache::parseFlatFile(std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
 
-    pn.dotify(out, nullptr);
+    _parser_impl::InputFile file(path);
+    return impl->get(file.view());
+}
 
-    out << "\n}\n";
+ParseCacheStats ParseCache::stats() const {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    return impl->stats;
+}
 
-    return out.str();
+void ParseCache::clear() {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->entries.clear();
+    impl->index.clear();
+    impl->stats.entries = 0;
+    impl->stats.bytes = 0;
 }
 
-/**
- * Uplift a node from the internal pointer-based representation into the 
- * external value-semantics representation.
-*/
-ParseNode uplift_node(_parser_impl::ParseNode* alien, int & idCounter) {
-    using _parser_impl::toExternal;
-    ParseNode retval;
-    retval.id = idCounter++;
+ProfileStats profile_stats() {
+    ProfileStats retval;
+#ifdef LEMON_PY_PROFILE
+    using _parser_impl::Profile;
+    using _parser_impl::ProfileSlot;
+    using _parser_impl::LexRuleKind;
+    auto & profile = Profile::get();
+    auto const& def = _parser_impl::LexerDef::get();
+    auto counter = [] (std::string name, ProfileSlot const& slot) {
+        return ProfileCounter { std::move(name), slot.attempts.load(), slot.hits.load(), slot.nanoseconds.load() };
+    };
 
-    if (std::holds_alternative<_parser_impl::Token>(alien->value)) {
-        auto tok = std::get<_parser_impl::Token>(alien->value);
-        retval.tokName = toExternal(tok.name());
-        retval.value = toExternal(tok.value());
+    retval.enabled = true;
+    for (int i = 0; i < Profile::StepCount; i++) {
+        retval.steps.push_back(counter(Profile::stepNames[i], profile.steps[i]));
     }
-    else {
-        retval.production = toExternal(std::get<_parser_impl::ustring>(alien->value));
+    for (size_t i = 0; i < def.ruleCount; i++) {
+        auto const& rule = def.rules[i];
+        auto & list = rule.kind == LexRuleKind::Skip ? retval.skips : rule.kind == LexRuleKind::Literal ? retval.literals : retval.values;
+        list.push_back(counter(rule.name, profile.rules[i]));
     }
-    retval.line = alien->line;
-    
-    for (auto c : alien->children) {
-        retval.children.push_back(uplift_node(c, idCounter));
+    for (size_t i = 0; i < def.stringDefs.size(); i++) {
+        retval.strings.push_back(counter(_parser_impl::toExternal(def.tokenName(std::get<2>(def.stringDefs[i]))), profile.strings[i]));
+    }
+    for (size_t i = 0; i < profile.grammarRuleCount; i++) {
+        std::string name = LemonPyParseRuleName(static_cast<int>(i));
+        if (name.empty()) name = "rule " + std::to_string(i); // built with NDEBUG, so Lemon has no rule text
+        retval.reductions.emplace_back(std::move(name), profile.reductions[i].load());
     }
+    retval.shifts = profile.shifts.load();
+#endif
+    return retval;
+}
 
-    return std::move(retval);
+void reset_profile_stats() {
+#ifdef LEMON_PY_PROFILE
+    using _parser_impl::Profile;
+    auto & profile = Profile::get();
+    auto const& def = _parser_impl::LexerDef::get();
+    for (auto & slot : profile.steps) slot.reset();
+    for (size_t i = 0; i < def.ruleCount; i++) profile.rules[i].reset();
+    for (size_t i = 0; i < def.stringDefs.size(); i++) profile.strings[i].reset();
+    for (size_t i = 0; i < profile.grammarRuleCount; i++) profile.reductions[i] = 0;
+    profile.shifts = 0;
+#endif
 }
 
 /**
- * Uplift a node from the internal poiner-based representation into the 
- * external value-semantics representation.
+ * A finished parse kept in the parser's internal form, along with the parser and input it
+ * points into.
 */
-ParseNode uplift_node(_parser_impl::ParseNode* alien) {
-    int idCounter = 0;
-    return uplift_node(alien, idCounter);
+struct LazyTree {
+    _parser_impl::Parser parser; ///< owns the nodes and any copied token values
+    std::string text; ///< input copied for `parse_lazy()`
+    std::optional<_parser_impl::InputFile> file; ///< input mapped for `parse_lazy_file()`
+    _parser_impl::ParseNode const* root = nullptr; ///< root of the parse tree
+
+    mutable std::mutex idMutex; ///< guards `ids`
+    mutable std::unordered_map<_parser_impl::ParseNode const*, int> ids; ///< ids handed out so far
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    mutable std::unordered_map<_parser_impl::ParseNode const*, py::dict> attrs; ///< attribute dictionaries created so far. Guarded by the GIL.
+#endif
+};
+
+LazyNodeRef parse_lazy(std::string input) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    auto tree = std::make_shared<LazyTree>();
+    tree->text = std::move(input);
+    tree->root = tree->parser.parseBuffer(tree->text);
+    return LazyNodeRef(tree, tree->root);
+}
+
+LazyNodeRef parse_lazy_file(std::string const& path) {
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    auto tree = std::make_shared<LazyTree>();
+    tree->file.emplace(path);
+    tree->root = tree->parser.parseBuffer(tree->file->view());
+    return LazyNodeRef(tree, tree->root);
 }
 
 /**
- * Parse a string and return a value-semantics parse node.
- * 
- * @throw std::runtime_error if there is a lex or parse error.
+ * A text kept parsed through edits. See `Document`.
 */
-ParseNode parse_string(std::string const& input) {
+struct Document::Impl {
+    using Token = _parser_impl::Token;
+    using ParseNode = _parser_impl::ParseNode;
+    using ReductionLog = _parser_impl::ReductionLog;
+
+    /** The part of the text changed since the tokens were last parsed. */
+    struct Damage {
+        size_t begin; ///< start of the change
+        size_t oldEnd; ///< end of the changed part in the text the tokens came from
+        size_t newEnd; ///< end of the changed part in the current text
+    };
+
+    /** A reused node, and enough of its old state to put it back if the reparse fails. */
+    struct Reuse {
+        ParseNode* node; ///< the node pushed
+        uint32_t childCount; ///< children it was pushed with
+        uint32_t oldSize; ///< children it had before
+        std::vector<ParseNode*> tail; ///< children it had past `childCount`, if any
+        size_t first; ///< old index of its first token
+        size_t length; ///< tokens it covers
+        bool shifted; ///< did it come from after the edit, so its positions were shifted?
+    };
+
+    std::shared_ptr<LazyTree> tree; ///< the last tree that parsed, and the parser and strings its tokens use
+    std::shared_ptr<LazyTree> replaced; ///< the tree a full parse last replaced, for `Document::edit()` to let go of with the GIL held
+    _parser_impl::ustring text; ///< the current text
+    std::vector<Token> tokens; ///< tokens of the last text that parsed, not counting the end of input
+    Token eof; ///< the end of input token that went with them
+    ReductionLog log; ///< reductions of the parses of `tokens`, chained by token index
+    size_t fullParseReductions = 0; ///< reductions logged by the last full parse
+    std::optional<Damage> damage; ///< edits not yet parsed
+    DocumentEditStats stats; ///< counters for the last edit
+
+    /** Parse the whole text into a new tree. */
+    void parseAll() {
+        auto newTree = std::make_shared<LazyTree>();
+        auto & parser = newTree->parser;
+        ReductionLog newLog;
+        std::vector<Token> newTokens;
+
+        parser.setLog(&newLog);
+        parser.beginReparse();
+        _parser_impl::Lexer lexer(text, parser.strings());
+        lexer.restartAt(0, 1, 0);
+        while (auto tok = lexer.next()) {
+            newLog.position = static_cast<uint32_t>(newTokens.size());
+            if (tok->type == 0) {
+                newLog.atEnd = true;
+                eof = tok.value();
+            }
+            else {
+                newTokens.push_back(tok.value());
+            }
+            parser.parseToken(tok.value());
+        }
+        newTree->root = parser.finishReparse();
+
+        newLog.heads.assign(newTokens.size(), ReductionLog::None);
+        for (auto const& [first, r] : newLog.made) {
+            newLog.add(first, r);
+        }
+        newLog.made.clear();
+
+        log = std::move(newLog);
+        parser.setLog(&log);
+        tokens = std::move(newTokens);
+        log.tokenNodes.assign(tokens.size(), nullptr);
+        indexTokenNodes();
+        replaced = std::move(tree);
+        tree = std::move(newTree);
+        fullParseReductions = log.size();
+        damage.reset();
+
+        stats.relexedTokens = tokens.size();
+        stats.parsedTokens = tokens.size();
+        stats.fullParse = true;
+    }
+
+    /**
+     * Could the lexer have ended a token differently if the text from `editBegin` on had been
+     * different? Lexes the token again with only the text before `editBegin` to go on.
+    */
+    bool tokenStable(Token const& tok, size_t editBegin) const {
+        _parser_impl::StringTable scratch;
+        _parser_impl::Lexer probe(_parser_impl::ustring_view(), scratch);
+        probe.setStreamInput(_parser_impl::ustring_view(text).substr(tok.span.begin, editBegin - tok.span.begin), true);
+        try {
+            auto again = probe.next();
+            return again && again->type == tok.type && again->span.end == tok.span.end - tok.span.begin;
+        }
+        catch (std::runtime_error const&) {
+            return false;
+        }
+    }
+
+    /** File the token nodes the last parse made under the tokens they came from. */
+    void indexTokenNodes() {
+        std::vector<std::pair<int64_t, ParseNode*>> made;
+        made.reserve(log.madeTokenNodes.size());
+        for (auto n : log.madeTokenNodes) {
+            made.emplace_back(std::get<Token>(n->value).span.begin, n);
+        }
+        log.madeTokenNodes.clear();
+        auto byBegin = [] (auto const& l, auto const& r) { return l.first < r.first; };
+        if (!std::is_sorted(made.begin(), made.end(), byBegin)) { // they're made in order, unless actions hold tokens back
+            std::sort(made.begin(), made.end(), byBegin);
+        }
+
+        auto it = tokens.begin();
+        for (size_t k = 0; k < made.size(); k++) {
+            auto [begin, node] = made[k];
+            it = std::lower_bound(it, tokens.end(), begin, [] (Token const& t, int64_t b) { return t.span.begin < b; });
+            if (it == tokens.end() || it->span.begin != begin || (k && made[k - 1].first == begin)) {
+                log.tokenNodesExact = false; // from a token some other way, or a second node from the same one
+                continue;
+            }
+            log.tokenNodes[it - tokens.begin()] = node;
+        }
+    }
+
+    /** Replace `v[first, last)` with the given values. */
+    template <typename T, typename It>
+    static void splice(std::vector<T> & v, size_t first, size_t last, It valuesBegin, It valuesEnd) {
+        size_t count = valuesEnd - valuesBegin;
+        size_t common = std::min(count, last - first);
+        std::copy(valuesBegin, valuesBegin + common, v.begin() + first);
+        if (count > common) {
+            v.insert(v.begin() + first + common, valuesBegin + common, valuesEnd);
+        }
+        else {
+            v.erase(v.begin() + first + common, v.begin() + last);
+        }
+    }
+
+    /**
+     * Relex and reparse the damaged part of the text.
+     * 
+     * @throw std::runtime_error on lex or parse error, leaving the last tree as it was.
+    */
+    void reparse() {
+        using _parser_impl::Lexer;
+        auto const N = tokens.size();
+        auto const [editBegin, oldEnd, newEnd] = damage.value();
+        int64_t const delta = static_cast<int64_t>(newEnd) - static_cast<int64_t>(oldEnd);
+        auto & parser = tree->parser;
+
+        // relex from the end of the last token the edit can't have changed
+        size_t a = std::lower_bound(tokens.begin(), tokens.end(), editBegin, [] (Token const& t, size_t offset) { return t.span.end < static_cast<int64_t>(offset); }) - tokens.begin();
+        while (a > 0 && !tokenStable(tokens[a - 1], editBegin)) a--;
+
+        Lexer lexer(text, parser.strings());
+        if (a > 0) {
+            auto const& span = tokens[a - 1].span;
+            lexer.restartAt(span.end, span.endLine, span.end - span.endColumn + 1);
+        }
+        else {
+            lexer.restartAt(0, 1, 0);
+        }
+
+        // ...until it's back in step with the old tokens past the edit
+        std::vector<Token> fresh;
+        size_t b = N;
+        Token newEof = _parser_impl::make_token(0, -1);
+        Token resync = newEof;
+        while (auto tok = lexer.next()) {
+            if (tok->type == 0) {
+                newEof = tok.value();
+                break;
+            }
+            if (tok->span.begin >= static_cast<int64_t>(newEnd)) {
+                int64_t oldBegin = tok->span.begin - delta;
+                auto old = std::lower_bound(tokens.begin() + a, tokens.end(), oldBegin, [] (Token const& t, int64_t offset) { return t.span.begin < offset; });
+                if (old != tokens.end() && old->span.begin == oldBegin && old->type == tok->type && old->span.end - old->span.begin == tok->span.end - tok->span.begin) {
+                    b = old - tokens.begin();
+                    resync = tok.value();
+                    break;
+                }
+            }
+            fresh.push_back(tok.value());
+        }
+        stats.relexedTokens = fresh.size() + (b < N);
+
+        // tokens past the resync point just move
+        int64_t dOffset = 0;
+        int dLine = 0, dColumn = 0, columnLine = -1;
+        if (b < N) {
+            dOffset = delta;
+            dLine = resync.span.beginLine - tokens[b].span.beginLine;
+            dColumn = resync.span.beginColumn - tokens[b].span.beginColumn;
+            columnLine = tokens[b].span.beginLine;
+        }
+        bool moved = dOffset || dLine || dColumn;
+        auto shift = [&] (Token & t) {
+            t.span.begin += dOffset;
+            t.span.end += dOffset;
+            if (t.span.beginLine == columnLine) t.span.beginColumn += dColumn;
+            if (t.span.endLine == columnLine) t.span.endColumn += dColumn;
+            t.span.beginLine += dLine;
+            t.span.endLine += dLine;
+            t.line += dLine;
+        };
+        auto unshift = [&] (Token & t) {
+            t.span.begin -= dOffset;
+            t.span.end -= dOffset;
+            t.span.beginLine -= dLine;
+            t.span.endLine -= dLine;
+            t.line -= dLine;
+            if (t.span.beginLine == columnLine) t.span.beginColumn -= dColumn;
+            if (t.span.endLine == columnLine) t.span.endColumn -= dColumn;
+        };
+
+        // move the positions in a reused subtree from past the edit, or put them back
+        bool const walkTokens = !log.tokenNodesExact; // token nodes are found through their tokens, unless some weren't filed
+        auto moveSubtree = [&] (Reuse const& reuse, bool back) {
+            int64_t const lines = back ? -dLine : dLine;
+            auto moveLine = [&] (ParseNode* n) { if (n->line >= 0) n->line += lines; };
+            auto moveToken = [&] (ParseNode* n) {
+                auto & tok = std::get<Token>(n->value);
+                back ? unshift(tok) : shift(tok);
+                moveLine(n);
+            };
+            if (!walkTokens) {
+                for (size_t k = reuse.first; k < reuse.first + reuse.length; k++) {
+                    if (auto n = log.tokenNodes[k]) moveToken(n);
+                }
+                if (!dLine) return; // productions only need visiting if lines moved
+            }
+            std::vector<ParseNode*> stack { reuse.node };
+            while (!stack.empty()) {
+                auto n = stack.back();
+                stack.pop_back();
+                if (std::holds_alternative<Token>(n->value)) {
+                    if (walkTokens) moveToken(n);
+                    continue;
+                }
+                moveLine(n);
+                stack.insert(stack.end(), n->children.begin(), n->children.end()); // `reuse.node` is cut down to `childCount` meanwhile
+            }
+        };
+
+        size_t const m = fresh.size();
+        size_t const total = a + m + (N - b);
+        auto oldIndex = [&] (size_t i) { return i < a ? i : i - a - m + b; };
+        auto tokenAt = [&] (size_t i) {
+            if (i < a) return tokens[i];
+            if (i < a + m) return fresh[i - a];
+            auto t = tokens[oldIndex(i)];
+            shift(t);
+            return t;
+        };
+        Token endToken = newEof;
+        if (b < N) {
+            endToken = eof;
+            shift(endToken);
+        }
+
+        std::vector<Reuse> reused;
+        std::vector<uint32_t> reparsed; // old indices of unchanged tokens parsed one at a time, whose reductions may not hold any more
+        std::vector<uint32_t> spanning; // tokens starting the stack entries when the parse reached the edit
+        auto takeSnapshot = [&] {
+            for (ptrdiff_t d = 1; d <= log.depth; d++) {
+                if (log.starts[d] < a) spanning.push_back(log.starts[d]);
+            }
+        };
+
+        ParseNode* root;
+        stats.reusedSubtrees = stats.reusedTokens = stats.parsedTokens = 0;
+        try {
+            parser.beginReparse();
+            log.made.clear();
+            log.atEnd = false;
+            log.depth = 0;
+
+            for (size_t i = 0; i < total; ) {
+                if (i == a) takeSnapshot();
+
+                auto tok = tokenAt(i);
+                log.position = static_cast<uint32_t>(i);
+                int state = parser.reduceFor(tok);
+
+                // the longest reduction from here that's still good, if the parser is in the state it was made in
+                _parser_impl::Reduction const* best = nullptr;
+                bool unchanged = i < a || i >= a + m;
+                if (unchanged) {
+                    size_t limit = i < a ? a - i : std::numeric_limits<size_t>::max(); // look-aheads before the edit are unchanged
+                    for (auto r = log.heads[oldIndex(i)]; r != ReductionLog::None; r = log.pool[r].next) {
+                        if (log.pool[r].length < limit) {
+                            best = &log.pool[r];
+                            break;
+                        }
+                    }
+                    if (best && (best->stateBelow != state || best->node->children.size < best->childCount)) best = nullptr;
+                }
+
+                if (best) {
+                    auto node = best->node;
+                    Reuse reuse { node, best->childCount, node->children.size, {}, oldIndex(i), best->length, moved && i >= a + m };
+                    if (reuse.oldSize > reuse.childCount) {
+                        reuse.tail.assign(node->children.begin() + reuse.childCount, node->children.end());
+                        node->children.size = reuse.childCount;
+                    }
+                    if (reuse.shifted) moveSubtree(reuse, false); // before the actions above it can read its lines
+                    reused.push_back(std::move(reuse));
+
+                    parser.pushSubtree(best->symbol, node);
+                    stats.reusedSubtrees++;
+                    stats.reusedTokens += best->length;
+                    i += best->length;
+                }
+                else {
+                    if (unchanged) reparsed.push_back(static_cast<uint32_t>(oldIndex(i)));
+                    parser.parseToken(tok);
+                    stats.parsedTokens++;
+                    i++;
+                }
+            }
+            if (a == total) takeSnapshot();
+
+            log.position = static_cast<uint32_t>(total);
+            log.atEnd = true;
+            parser.parseToken(endToken);
+            root = parser.finishReparse();
+        }
+        catch (...) {
+            for (auto it = reused.rbegin(); it != reused.rend(); ++it) { // put back the children and positions the old tree had
+                if (it->shifted) moveSubtree(*it, true);
+                std::copy(it->tail.begin(), it->tail.end(), it->node->children.begin() + it->childCount);
+                it->node->children.size = it->oldSize;
+            }
+            log.made.clear();
+            log.madeTokenNodes.clear();
+            throw;
+        }
+
+        // drop the reductions the edit invalidated
+        for (auto first : spanning) {
+            log.purgeReaching(first, static_cast<uint32_t>(a));
+        }
+        for (size_t k = a; k < b; k++) {
+            log.freeChain(log.heads[k]);
+        }
+        for (auto k : reparsed) {
+            log.freeChain(log.heads[k]);
+            log.tokenNodes[k] = nullptr;
+        }
+
+        // splice in the new tokens, and move the ones after them
+        splice(tokens, a, b, fresh.begin(), fresh.end());
+        std::vector<uint32_t> noReductions(m, ReductionLog::None);
+        splice(log.heads, a, b, noReductions.begin(), noReductions.end());
+        std::vector<ParseNode*> noNodes(m, nullptr);
+        splice(log.tokenNodes, a, b, noNodes.begin(), noNodes.end());
+        if (moved) { // their nodes were moved as they were reused
+            for (size_t i = a + m; i < total; i++) {
+                shift(tokens[i]);
+            }
+        }
+        eof = endToken;
+        indexTokenNodes();
+
+        for (auto const& [first, r] : log.made) {
+            log.add(first, r);
+        }
+        log.made.clear();
+
+        tree->root = root;
+        damage.reset();
+
+        if (log.size() > 2 * std::max<size_t>(fullParseReductions, 4096)) { // too many reparses' worth of nodes left behind
+            parseAll();
+        }
+    }
+};
+
+Document::Document(std::string text) : impl(std::make_unique<Impl>()) {
 #ifndef LEMON_PY_SUPPRESS_PYTHON
     py::gil_scoped_release _release_GIL;
 #endif
 
-    using namespace _parser_impl;
-    Parser p;
-    return uplift_node(p.parseString(input));
+#ifdef LEMON_PY_UNICODE_SUPPORT
+    utf8::utf8to32(text.begin(), text.end(), std::back_inserter(impl->text));
+#elif defined(LEMON_PY_UTF8_SUPPORT)
+    _parser_impl::checkUtf8(text);
+    impl->text = std::move(text);
+#else
+    impl->text = std::move(text);
+#endif
+    impl->parseAll();
+}
+
+Document::Document(Document &&) noexcept = default;
+Document& Document::operator=(Document &&) noexcept = default;
+Document::~Document() = default;
+
+LazyNodeRef Document::edit(size_t begin, size_t end, std::string_view replacement) {
+    std::shared_ptr<LazyTree> replaced; // may hold the last references to attribute dictionaries, so dropped after the GIL is back
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+    py::gil_scoped_release _release_GIL;
+#endif
+
+    auto & text = impl->text;
+    if (begin > end || end > text.size()) {
+        throw std::runtime_error("Edit range is out of bounds.");
+    }
+
+#ifdef LEMON_PY_UNICODE_SUPPORT
+    _parser_impl::ustring internal;
+    utf8::utf8to32(replacement.begin(), replacement.end(), std::back_inserter(internal));
+#elif defined(LEMON_PY_UTF8_SUPPORT)
+    auto splitsCharacter = [&] (size_t offset) { return offset < text.size() && (static_cast<unsigned char>(text[offset]) & 0xC0) == 0x80; };
+    if (splitsCharacter(begin) || splitsCharacter(end)) {
+        throw std::runtime_error("Edit range splits a UTF-8 sequence.");
+    }
+    _parser_impl::checkUtf8(replacement);
+    auto internal = replacement;
+#else
+    auto internal = replacement;
+#endif
+    text.replace(begin, end - begin, internal);
+
+    // fold the edit into any earlier ones that haven't parsed yet
+    if (auto & damage = impl->damage) {
+        size_t last = std::max(damage->newEnd, end); // in the text before this edit
+        damage->oldEnd = last - (damage->newEnd - damage->oldEnd);
+        damage->newEnd = last - (end - begin) + internal.size();
+        damage->begin = std::min(damage->begin, begin);
+    }
+    else {
+        damage = Impl::Damage { begin, end, begin + internal.size() };
+    }
+
+    impl->stats = DocumentEditStats();
+    impl->reparse();
+    replaced = std::move(impl->replaced);
+    return root();
+}
+
+LazyNodeRef Document::root() const {
+    return LazyNodeRef(impl->tree, impl->tree->root);
+}
+
+std::string Document::text() const {
+    return _parser_impl::toExternal(impl->text);
+}
+
+DocumentEditStats Document::lastEditStats() const {
+    return impl->stats;
+}
+
+bool LazyNodeRef::isTerminal() const {
+    return std::holds_alternative<_parser_impl::Token>(node->value);
+}
+
+int32_t LazyNodeRef::symbol() const {
+    if (auto tok = std::get_if<_parser_impl::Token>(&node->value)) {
+        return tok->type;
+    }
+    return std::get<_parser_impl::Production>(node->value).symbol;
+}
+
+std::optional<std::string_view> LazyNodeRef::production() const {
+    if (isTerminal()) return std::nullopt;
+    return std::string_view(symbol_name(symbol()));
+}
+
+std::optional<std::string_view> LazyNodeRef::tokName() const {
+    if (!isTerminal()) return std::nullopt;
+    return std::string_view(symbol_name(symbol()));
+}
+
+std::optional<std::string> LazyNodeRef::value() const {
+    if (auto tok = std::get_if<_parser_impl::Token>(&node->value)) {
+        return _parser_impl::toExternal(tok->valueView());
+    }
+    return std::nullopt;
+}
+
+int64_t LazyNodeRef::line() const {
+    return node->line;
+}
+
+SourceSpan LazyNodeRef::span() const {
+    using _parser_impl::Token;
+    if (auto tok = std::get_if<Token>(&node->value)) {
+        return uplift_span(tok->span);
+    }
+
+    // a production covers its children, which may be productions themselves
+    SourceSpan retval;
+    std::vector<_parser_impl::ParseNode const*> stack(node->children.begin(), node->children.end());
+    while (!stack.empty()) {
+        auto n = stack.back();
+        stack.pop_back();
+        if (auto tok = std::get_if<Token>(&n->value)) {
+            retval = retval.merge(uplift_span(tok->span));
+        }
+        else {
+            stack.insert(stack.end(), n->children.begin(), n->children.end());
+        }
+    }
+    return retval;
+}
+
+int LazyNodeRef::id() const {
+    std::lock_guard<std::mutex> lock(tree->idMutex);
+    return tree->ids.try_emplace(node, static_cast<int>(tree->ids.size())).first->second;
+}
+
+size_t LazyNodeRef::childCount() const {
+    return node->children.size;
+}
+
+LazyNodeRef LazyNodeRef::operator[](size_t index) const {
+    if (index >= childCount()) {
+        throw std::runtime_error("Child index out of range.");
+    }
+    return LazyNodeRef(tree, node->children[index]);
+}
+
+std::vector<LazyNodeRef> LazyNodeRef::children() const {
+    std::vector<LazyNodeRef> retval;
+    retval.reserve(childCount());
+    for (auto c : node->children) {
+        retval.emplace_back(tree, c);
+    }
+    return retval;
+}
+
+ParseNode LazyNodeRef::uplift() const {
+    return uplift_node(node);
+}
+
+#ifndef LEMON_PY_SUPPRESS_PYTHON
+py::dict LazyNodeRef::attr() const {
+    return tree->attrs[node];
+}
+
+py::dict LazyNodeRef::asDict() const {
+    using _parser_impl::Token;
+
+    struct Entry {
+        py::dict dict;
+        size_t parent; ///< index of the parent's entry, or -1 for the root
+        SourceSpan span;
+    };
+    std::vector<Entry> entries; // in pre-order, so that spans can be merged bottom-up afterward
+
+    struct Frame {
+        LazyNodeRef n;
+        py::list siblings; ///< the parent's child list
+        size_t parent;
+    };
+    std::vector<Frame> stack;
+    stack.push_back({*this, py::list(), static_cast<size_t>(-1)});
+
+    while (!stack.empty()) {
+        auto [n, siblings, parent] = std::move(stack.back());
+        stack.pop_back();
+
+        py::dict myDict;
+        myDict["production"] = n.getProduction();
+        myDict["type"] = n.getToken();
+        myDict["value"] = n.getValue();
+        myDict["id"] = n.id();
+        myDict["line"] = n.line();
+        myDict["span"] = py::none(); // filled in below, once the children are done
+        myDict["attr"] = n.attr();
+
+        auto childList = py::list();
+        myDict["c"] = childList;
+        for (uint32_t i = n.node->children.size; i-- > 0;) {
+            stack.push_back({LazyNodeRef(tree, n.node->children[i]), childList, entries.size()}); // reversed, so children are appended in order
+        }
+
+        auto tok = std::get_if<Token>(&n.node->value);
+        entries.push_back({myDict, parent, tok ? uplift_span(tok->span) : SourceSpan()});
+        if (parent != static_cast<size_t>(-1)) {
+            siblings.append(myDict);
+        }
+    }
+
+    // children follow their parents, so walking backward finishes each span before its parent needs it
+    for (size_t i = entries.size(); i-- > 0;) {
+        auto & e = entries[i];
+        e.dict["span"] = e.span.asTuple();
+        if (e.parent != static_cast<size_t>(-1)) {
+            entries[e.parent].span = entries[e.parent].span.merge(e.span);
+        }
+    }
+
+    return entries.front().dict;
+}
+#endif
+
+bool LazyNodeRef::operator==(LazyNodeRef const& o) const {
+    using _parser_impl::Token;
+    std::vector<std::pair<_parser_impl::ParseNode const*, _parser_impl::ParseNode const*>> stack { {node, o.node} };
+    while (!stack.empty()) {
+        auto [a, b] = stack.back();
+        stack.pop_back();
+        if (a == b) continue;
+
+        if (a->children.size != b->children.size) return false;
+        auto ta = std::get_if<Token>(&a->value), tb = std::get_if<Token>(&b->value);
+        if (!ta != !tb) return false;
+        if (ta && (ta->type != tb->type || ta->valueView() != tb->valueView())) return false;
+        if (!ta && std::get<_parser_impl::Production>(a->value).symbol != std::get<_parser_impl::Production>(b->value).symbol) return false;
+
+        for (uint32_t i = 0; i < a->children.size; i++) {
+            stack.emplace_back(a->children[i], b->children[i]);
+        }
+    }
+    return true;
 }
 
 } // namespace parser
@@ -972,7 +4285,69 @@ ParseNode parse_string(std::string const& input) {
 #ifndef LEMON_PY_SUPPRESS_PYTHON
 PYBIND11_MODULE(PYTHON_PARSER_MODULE_NAME, m) {
     m.def("parse", &parser::parse_string, "Parse a string into a parse tree.", py::return_value_policy::move);
+    m.def("parse_buffer", 
+        [](py::buffer input) {
+            py::buffer_info info = input.request();
+            if (info.ndim > 1 || (info.ndim == 1 && info.strides[0] != info.itemsize)) {
+                throw std::runtime_error("Input buffer must be contiguous.");
+            }
+            return parser::parse_buffer(static_cast<const char*>(info.ptr), info.size * info.itemsize);
+        },
+        "Parse a bytes-like object in place into a parse tree, without copying it.", py::return_value_policy::move);
+    m.def("parse_file", &parser::parse_file, "Memory-map a file and parse it into a parse tree.", py::return_value_policy::move);
     m.def("dotify", &parser::dotify, "Get a graphviz DOT representation of the parse tree.");
+    m.def("dotify", [](parser::LazyNodeRef const& n) { return parser::dotify(n.uplift()); }, "Get a graphviz DOT representation of a lazy parse tree.");
+    m.def("dotify_file", &parser::dotify_file, "Write a graphviz DOT representation of the parse tree to a file.", py::arg("node"), py::arg("path"));
+    m.def("dotify_file", [](parser::LazyNodeRef const& n, std::string const& path) { parser::dotify_file(n.uplift(), path); }, "Write a graphviz DOT representation of a lazy parse tree to a file.", py::arg("node"), py::arg("path"));
+    m.def("symbol_name", &parser::symbol_name, "Get the production or token name for a symbol id.");
+    m.def("production_id", [](std::string const& name) { return parser::symbol_id_or_none(parser::production_id(name)); }, "Get the symbol id for a production name, or `None` if there is no such production.");
+    m.def("type_id", [](std::string const& name) { return parser::symbol_id_or_none(parser::type_id(name)); }, "Get the symbol id for a token name, or `None` if there is no such token.");
+    m.def("grammar_fingerprint", &parser::grammar_fingerprint, "Get the fingerprint of the grammar this parser was built from.");
+    m.def("stats", 
+        []() {
+            auto stats = parser::profile_stats();
+            auto counters = [](std::vector<parser::ProfileCounter> const& list) {
+                py::dict retval;
+                for (auto const& c : list) {
+                    py::dict counter;
+                    counter["attempts"] = c.attempts;
+                    counter["hits"] = c.hits;
+                    counter["ns"] = c.nanoseconds;
+                    retval[py::str(c.name)] = counter;
+                }
+                return retval;
+            };
+            py::dict reductions;
+            for (auto const& [rule, count] : stats.reductions) {
+                reductions[py::str(rule)] = count;
+            }
+
+            py::dict retval;
+            retval["enabled"] = stats.enabled;
+            retval["steps"] = counters(stats.steps);
+            retval["skips"] = counters(stats.skips);
+            retval["literals"] = counters(stats.literals);
+            retval["values"] = counters(stats.values);
+            retval["strings"] = counters(stats.strings);
+            retval["reductions"] = reductions;
+            retval["shifts"] = stats.shifts;
+            return retval;
+        },
+        "Get the lexer and parser counters of a `--profile` build as a dictionary.");
+    m.def("reset_stats", &parser::reset_profile_stats, "Zero the counters of a `--profile` build.");
+
+    py::class_<parser::SourceSpan>(m, "Span")
+    .def("__repr__", 
+        [](parser::SourceSpan const& s) { 
+            return py::str("<Span {}:{}-{}:{} [{}, {})>").format(s.beginLine, s.beginColumn, s.endLine, s.endColumn, s.begin, s.end); 
+        })
+    .def("as_tuple", &parser::SourceSpan::asTuple, "Get `(begin, end, begin_line, begin_column, end_line, end_column)`.")
+    .def_readonly("begin", &parser::SourceSpan::begin, "Offset of the first byte (code point, for `--unicode` parsers), or -1 if unknown.")
+    .def_readonly("end", &parser::SourceSpan::end, "Offset just past the last byte (code point, for `--unicode` parsers), or -1 if unknown.")
+    .def_readonly("begin_line", &parser::SourceSpan::beginLine, "Line of `begin`, counting from 1.")
+    .def_readonly("begin_column", &parser::SourceSpan::beginColumn, "Column of `begin`, counting from 1.")
+    .def_readonly("end_line", &parser::SourceSpan::endLine, "Line of `end`, counting from 1.")
+    .def_readonly("end_column", &parser::SourceSpan::endColumn, "Column of `end`, counting from 1.");
 
     auto pn = py::class_<parser::ParseNode>(m, "Node")
     .def(py::init<>())
@@ -991,11 +4366,198 @@ PYBIND11_MODULE(PYTHON_PARSER_MODULE_NAME, m) {
     .def_property_readonly("production", &parser::ParseNode::getProduction, "Get production if non-terminal.", py::return_value_policy::take_ownership) // these return copies of strings
     .def_property_readonly("name", &parser::ParseNode::getProduction, "Get production if non-terminal. (alias for `.production`)", py::return_value_policy::take_ownership) // these return copies of strings
     .def_property_readonly("type", &parser::ParseNode::getToken, "Get type if terminal.", py::return_value_policy::take_ownership)
+    .def_property_readonly("production_id", &parser::ParseNode::getProductionId, "Get production symbol id if non-terminal.")
+    .def_property_readonly("type_id", &parser::ParseNode::getTypeId, "Get type symbol id if terminal.")
     .def_property_readonly("value", &parser::ParseNode::getValue, "Get value if terminal.", py::return_value_policy::take_ownership)
     .def_readonly("line", &parser::ParseNode::line, "Line number of appearance.")
+    .def_readonly("span", &parser::ParseNode::span, "Part of the input this node came from.")
     .def_readonly("c", &parser::ParseNode::children, "Children.", py::return_value_policy::reference_internal)
     .def_readonly("id", &parser::ParseNode::id, "ID number for this node (unique within tree).")
-    .def_readonly("attr", &parser::ParseNode::attr, "Free-use attributes dictionary.");
+    .def_property_readonly("attr", &parser::ParseNode::getAttr, "Free-use attributes dictionary.");
+
+    py::class_<parser::LazyNodeRef>(m, "LazyNode")
+    .def("__repr__", 
+        [](parser::LazyNodeRef const& n) {
+            if (!n.isTerminal()) return py::str("{{{}}} [{}]").format(*n.production(), n.childCount());
+            return py::str("{} <{}>").format(*n.tokName(), *n.value());
+        }, 
+        "Get an approximation of the representation.")
+    .def("__getitem__", 
+        [](parser::LazyNodeRef const& n, size_t item) -> py::object {
+            if (item >= n.childCount()) return py::none();
+            return py::cast(n[item]);
+        }, 
+        "Get a child by index. Returns `None` if out of range.")
+    .def("__iter__", [](parser::LazyNodeRef const& n) { return py::iter(py::cast(n.children())); }, "Children iterator.")
+    .def("__len__", &parser::LazyNodeRef::childCount, "Get number of children.")
+    .def("as_dict", &parser::LazyNodeRef::asDict, "Make a deep copy of this node and all children to a dictionary representation. `.attr` is ref-copied, but not deep-copied. ")
+    .def("uplift", &parser::LazyNodeRef::uplift, "Convert this node and all children to a regular `Node`.", py::return_value_policy::move)
+    .def(py::self == py::self)
+    .def(py::self != py::self)
+    .def_property_readonly("production", &parser::LazyNodeRef::getProduction, "Get production if non-terminal.")
+    .def_property_readonly("name", &parser::LazyNodeRef::getProduction, "Get production if non-terminal. (alias for `.production`)")
+    .def_property_readonly("type", &parser::LazyNodeRef::getToken, "Get type if terminal.")
+    .def_property_readonly("production_id", [](parser::LazyNodeRef const& n) { return parser::symbol_id_or_none(n.isTerminal() ? -1 : n.symbol()); }, "Get production symbol id if non-terminal.")
+    .def_property_readonly("type_id", [](parser::LazyNodeRef const& n) { return parser::symbol_id_or_none(n.isTerminal() ? n.symbol() : -1); }, "Get type symbol id if terminal.")
+    .def_property_readonly("value", &parser::LazyNodeRef::getValue, "Get value if terminal.")
+    .def_property_readonly("line", &parser::LazyNodeRef::line, "Line number of appearance.")
+    .def_property_readonly("span", &parser::LazyNodeRef::span, "Part of the input this node came from.")
+    .def_property_readonly("c", &parser::LazyNodeRef::children, "Children.")
+    .def_property_readonly("id", &parser::LazyNodeRef::id, "ID number for this node (unique within tree).")
+    .def_property_readonly("attr", &parser::LazyNodeRef::attr, "Free-use attributes dictionary.");
+
+    m.def("parse_lazy", &parser::parse_lazy, "Parse a string into a parse tree that's converted to Python objects only as it's visited.", py::return_value_policy::move);
+    m.def("parse_lazy_file", &parser::parse_lazy_file, "Memory-map a file and parse it into a parse tree that's converted to Python objects only as it's visited.", py::return_value_policy::move);
+
+    m.def("parse_flat", &parser::parse_flat, "Parse a string into a flat parse tree.", py::return_value_policy::move);
+    m.def("parse_flat_file", &parser::parse_flat_file, "Memory-map a file and parse it into a flat parse tree.", py::return_value_policy::move);
+    m.def("flatten", &parser::flatten, "Convert a parse tree into a flat parse tree.", py::return_value_policy::move);
+
+    m.def("parse_many", 
+        [](py::iterable inputs, size_t threads) {
+            auto os = py::module_::import("os");
+            auto pathLike = os.attr("PathLike");
+            std::vector<std::string> storage; // copied so the GIL can be released while parsing
+            std::vector<bool> isFile;
+            for (auto item : inputs) {
+                bool path = py::isinstance(item, pathLike);
+                storage.push_back(py::cast<std::string>(path ? os.attr("fspath")(item) : py::reinterpret_borrow<py::object>(item)));
+                isFile.push_back(path);
+            }
+
+            std::vector<parser::BatchInput> batch;
+            batch.reserve(storage.size());
+            for (size_t i = 0; i < storage.size(); i++) {
+                batch.push_back({storage[i], isFile[i]});
+            }
+
+            auto results = parser::parse_batch(batch, threads);
+
+            py::list retval;
+            for (auto & r : results) {
+                if (r.ok()) {
+                    retval.append(py::cast(std::move(*r.tree)));
+                }
+                else {
+                    retval.append(py::handle(PyExc_RuntimeError)(r.error));
+                }
+            }
+            return retval;
+        },
+        "Parse many inputs in parallel. `str` and `bytes` items are parsed as text, and `os.PathLike` items are memory-mapped files. Returns a list of parse trees in input order, with a `RuntimeError` in place of any input that failed.",
+        py::arg("inputs"), py::arg("threads") = 0);
+
+    py::class_<parser::ParserContext>(m, "ParserContext")
+    .def(py::init<>())
+    .def("parse", &parser::ParserContext::parse, "Parse a string into a parse tree.", py::return_value_policy::move)
+    .def("parse_buffer", 
+        [](parser::ParserContext & c, py::buffer input) {
+            py::buffer_info info = input.request();
+            if (info.ndim > 1 || (info.ndim == 1 && info.strides[0] != info.itemsize)) {
+                throw std::runtime_error("Input buffer must be contiguous.");
+            }
+            return c.parseBuffer(static_cast<const char*>(info.ptr), info.size * info.itemsize);
+        },
+        "Parse a bytes-like object in place into a parse tree, without copying it.", py::return_value_policy::move)
+    .def("parse_file", &parser::ParserContext::parseFile, "Memory-map a file and parse it into a parse tree.", py::return_value_policy::move)
+    .def("parse_flat", &parser::ParserContext::parseFlat, "Parse a string into a flat parse tree.", py::return_value_policy::move);
+
+    py::class_<parser::ParseCache>(m, "ParseCache")
+    .def(py::init<size_t, std::string const&>(), py::arg("max_bytes") = size_t(256 << 20), py::arg("directory") = "")
+    .def("parse", &parser::ParseCache::parse, "Parse a string into a parse tree, or get its tree from the cache.", py::return_value_policy::move)
+    .def("parse_buffer", 
+        [](parser::ParseCache & c, py::buffer input) {
+            py::buffer_info info = input.request();
+            if (info.ndim > 1 || (info.ndim == 1 && info.strides[0] != info.itemsize)) {
+                throw std::runtime_error("Input buffer must be contiguous.");
+            }
+            return c.parseBuffer(static_cast<const char*>(info.ptr), info.size * info.itemsize);
+        },
+        "Parse a bytes-like object in place into a parse tree, or get its tree from the cache.", py::return_value_policy::move)
+    .def("parse_file", &parser::ParseCache::parseFile, "Memory-map a file and parse it into a parse tree, or get its tree from the cache.", py::return_value_policy::move)
+    .def("parse_flat", &parser::ParseCache::parseFlat, "Parse a string into a flat parse tree, or get its tree from the cache.", py::return_value_policy::move)
+    .def("parse_flat_file", &parser::ParseCache::parseFlatFile, "Memory-map a file and parse it into a flat parse tree, or get its tree from the cache.", py::return_value_policy::move)
+    .def("stats", 
+        [](parser::ParseCache const& c) {
+            auto stats = c.stats();
+            py::dict retval;
+            retval["hits"] = stats.hits;
+            retval["disk_hits"] = stats.diskHits;
+            retval["misses"] = stats.misses;
+            retval["evictions"] = stats.evictions;
+            retval["entries"] = stats.entries;
+            retval["bytes"] = stats.bytes;
+            return retval;
+        },
+        "Get the hit, miss, and size counters as a dictionary.")
+    .def("clear", &parser::ParseCache::clear, "Drop every tree held in memory.");
+
+    py::class_<parser::Document>(m, "Document")
+    .def(py::init<std::string>(), py::arg("text"))
+    .def("edit", &parser::Document::edit, "Replace the text from `begin` to `end` and reparse only what changed. Returns the new root.", py::arg("begin"), py::arg("end"), py::arg("replacement"))
+    .def_property_readonly("root", &parser::Document::root, "Get the root of the last tree that parsed.")
+    .def_property_readonly("text", &parser::Document::text, "Get the current text.")
+    .def("last_edit_stats", 
+        [](parser::Document const& d) {
+            auto stats = d.lastEditStats();
+            py::dict retval;
+            retval["relexed_tokens"] = stats.relexedTokens;
+            retval["reused_subtrees"] = stats.reusedSubtrees;
+            retval["reused_tokens"] = stats.reusedTokens;
+            retval["parsed_tokens"] = stats.parsedTokens;
+            retval["full_parse"] = stats.fullParse;
+            return retval;
+        },
+        "Get the relex, reuse, and reparse counters for the last edit as a dictionary.");
+
+    py::class_<parser::ParserPool>(m, "ParserPool")
+    .def(py::init<>())
+    .def("parse", &parser::ParserPool::parse, "Parse a string into a parse tree using a pooled context.", py::return_value_policy::move)
+    .def("parse_file", &parser::ParserPool::parseFile, "Memory-map a file and parse it into a parse tree using a pooled context.", py::return_value_policy::move)
+    .def("parse_flat", &parser::ParserPool::parseFlat, "Parse a string into a flat parse tree using a pooled context.", py::return_value_policy::move)
+    .def_property_readonly("idle_count", &parser::ParserPool::idleCount, "Number of contexts waiting to be used.");
+
+    py::class_<parser::IncrementalParser>(m, "IncrementalParser")
+    .def(py::init<bool>(), py::arg("intern_values") = false)
+    .def("feed", 
+        [](parser::IncrementalParser & p, py::buffer chunk) {
+            py::buffer_info info = chunk.request();
+            if (info.ndim > 1 || (info.ndim == 1 && info.strides[0] != info.itemsize)) {
+                throw std::runtime_error("Input buffer must be contiguous.");
+            }
+            p.feed(std::string_view(static_cast<const char*>(info.ptr), info.size * info.itemsize));
+        },
+        "Add the next chunk of input from a bytes-like object.")
+    .def("feed", [](parser::IncrementalParser & p, std::string const& chunk) { p.feed(chunk); }, "Add the next chunk of input from a string.")
+    .def("finish", &parser::IncrementalParser::finish, "Finish the parse and return the parse tree.", py::return_value_policy::move)
+    .def("finish_flat", &parser::IncrementalParser::finishFlat, "Finish the parse and return a flat parse tree.", py::return_value_policy::move);
+
+    py::class_<parser::FlatTree>(m, "FlatTree")
+    .def("__len__", &parser::FlatTree::size, "Get number of nodes.")
+    .def("__getitem__", [](parser::FlatTree const& t, size_t index) { return t[index]; }, "Get a node by pre-order index.", py::keep_alive<0, 1>())
+    .def_property_readonly("root", py::cpp_function(&parser::FlatTree::root, py::keep_alive<0, 1>()), "Get the root node.")
+    .def("save", &parser::FlatTree::save, "Save the tree to a binary file.", py::arg("path"))
+    .def_static("load", &parser::FlatTree::load, "Map a tree saved by `save()` back in.", py::arg("path"), py::return_value_policy::move);
+
+    py::class_<parser::FlatNodeRef>(m, "FlatNode")
+    .def("__getitem__", 
+        [](parser::FlatNodeRef const& n, size_t item) -> py::object {
+            if (item >= n.childCount()) return py::none();
+            return py::cast(n[item]);
+        }, 
+        "Get a child by index. Returns `None` if out of range.", py::keep_alive<0, 1>())
+    .def("__iter__", [](parser::FlatNodeRef const& n) { return py::make_iterator(n.begin(), n.end()); }, "Children iterator.", py::keep_alive<0, 1>())
+    .def("__len__", &parser::FlatNodeRef::childCount, "Get number of children.")
+    .def_property_readonly("production", &parser::FlatNodeRef::production, "Get production if non-terminal.")
+    .def_property_readonly("name", &parser::FlatNodeRef::production, "Get production if non-terminal. (alias for `.production`)")
+    .def_property_readonly("type", &parser::FlatNodeRef::tokName, "Get type if terminal.")
+    .def_property_readonly("production_id", [](parser::FlatNodeRef const& n) { return parser::symbol_id_or_none(n.isTerminal() ? -1 : n.symbol()); }, "Get production symbol id if non-terminal.")
+    .def_property_readonly("type_id", [](parser::FlatNodeRef const& n) { return parser::symbol_id_or_none(n.isTerminal() ? n.symbol() : -1); }, "Get type symbol id if terminal.")
+    .def_property_readonly("value", &parser::FlatNodeRef::value, "Get value if terminal.")
+    .def_property_readonly("line", &parser::FlatNodeRef::line, "Line number of appearance.")
+    .def_property_readonly("span", &parser::FlatNodeRef::span, "Part of the input this node came from.", py::return_value_policy::copy)
+    .def_property_readonly("id", &parser::FlatNodeRef::id, "Pre-order index of this node (unique within tree).")
+    .def_property_readonly("subtree_size", &parser::FlatNodeRef::subtreeSize, "Number of nodes in this subtree, including this one.");
 }
 #endif
 
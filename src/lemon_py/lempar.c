@@ -101,6 +101,21 @@
 # define yytestcase(X)
 #endif
 
+/* Define the yyShiftHook() and yyReduceHook() macros to be no-ops if they
+** are not already defined.
+**
+** Applications can define them in the %include section (or ahead of this
+** file) to watch the parse as it happens.  yyShiftHook(P) runs after a
+** symbol is shifted onto the stack of parser P, and yyReduceHook(P,R) runs
+** after rule R has replaced its right-hand side with its left-hand side.
+*/
+#ifndef yyShiftHook
+# define yyShiftHook(P)
+#endif
+#ifndef yyReduceHook
+# define yyReduceHook(P,R)
+#endif
+
 
 /* Next are the tables used to determine what action to take based on the
 ** current state and lookahead token.  These tables are used to implement
@@ -286,10 +301,10 @@ static int yyGrowStack(yyParser *p){
   newSize = p->yystksz*2 + 100;
   idx = p->yytos ? (int)(p->yytos - p->yystack) : 0;
   if( p->yystack==&p->yystk0 ){
-    pNew = malloc(newSize*sizeof(pNew[0]));
+    pNew = (yyStackEntry*)malloc(newSize*sizeof(pNew[0]));
     if( pNew ) pNew[0] = p->yystk0;
   }else{
-    pNew = realloc(p->yystack, newSize*sizeof(pNew[0]));
+    pNew = (yyStackEntry*)realloc(p->yystack, newSize*sizeof(pNew[0]));
   }
   if( pNew ){
     p->yystack = pNew;
@@ -926,8 +941,10 @@ void Parse(
 #endif
       }
       yyact = yy_reduce(yypParser,yyruleno,yymajor,yyminor ParseCTX_PARAM);
+      yyReduceHook(yypParser,yyruleno);
     }else if( yyact <= YY_MAX_SHIFTREDUCE ){
       yy_shift(yypParser,yyact,(YYCODETYPE)yymajor,yyminor);
+      yyShiftHook(yypParser);
 #ifndef YYNOERRORRECOVERY
       yypParser->yyerrcnt--;
 #endif
@@ -1054,6 +1071,103 @@ void Parse(
   return;
 }
 
+/*
+** Run every reduction that the look-ahead token yymajor calls for, without
+** shifting the token, and return the state left on top of the stack.  A
+** following call to Parse() with the same token picks up from there.
+**
+** This lets an application look at the parser state at a token boundary,
+** for instance to decide whether a subtree from an earlier parse of the
+** same input can be pushed with ParseGoto() instead of being parsed again.
+*/
+int ParseReduce(
+  void *yyp,                   /* The parser */
+  int yymajor,                 /* The major token code number */
+  ParseTOKENTYPE yyminor       /* The value for the token */
+  ParseARG_PDECL               /* Optional %extra_argument parameter */
+){
+  YYACTIONTYPE yyact;
+  yyParser *yypParser = (yyParser*)yyp;  /* The parser */
+  ParseCTX_FETCH
+  ParseARG_STORE
+
+  while( (yyact = yy_find_shift_action((YYCODETYPE)yymajor,
+                                       yypParser->yytos->stateno))>=YY_MIN_REDUCE ){
+    unsigned int yyruleno = yyact - YY_MIN_REDUCE;
+    if( yyRuleInfoNRhs[yyruleno]==0 ){
+#if YYSTACKDEPTH>0 
+      if( yypParser->yytos>=yypParser->yystackEnd ){
+        yyStackOverflow(yypParser);
+        break;
+      }
+#else
+      if( yypParser->yytos>=&yypParser->yystack[yypParser->yystksz-1] ){
+        if( yyGrowStack(yypParser) ){
+          yyStackOverflow(yypParser);
+          break;
+        }
+      }
+#endif
+    }
+    yy_reduce(yypParser,yyruleno,yymajor,yyminor ParseCTX_PARAM);
+    yyReduceHook(yypParser,yyruleno);
+  }
+  return yypParser->yytos->stateno;
+}
+
+/*
+** Push the non-terminal yymajor onto the stack as if a rule had just been
+** reduced to it, and return the new top state.  The nValue bytes at pValue
+** are copied into the new stack entry as its value.
+*/
+int ParseGoto(
+  void *yyp,                   /* The parser */
+  int yymajor,                 /* The non-terminal's code number */
+  const void *pValue,          /* The value for the non-terminal */
+  size_t nValue                /* Size of the value */
+){
+  YYACTIONTYPE yyact;
+  yyParser *yypParser = (yyParser*)yyp;  /* The parser */
+
+  assert( nValue<=sizeof(YYMINORTYPE) );
+  yyact = yy_find_reduce_action(yypParser->yytos->stateno,(YYCODETYPE)yymajor);
+  yypParser->yytos++;
+#if YYSTACKDEPTH>0 
+  if( yypParser->yytos>yypParser->yystackEnd ){
+    yypParser->yytos--;
+    yyStackOverflow(yypParser);
+    return yypParser->yytos->stateno;
+  }
+#else
+  if( yypParser->yytos>=&yypParser->yystack[yypParser->yystksz] ){
+    if( yyGrowStack(yypParser) ){
+      yypParser->yytos--;
+      yyStackOverflow(yypParser);
+      return yypParser->yytos->stateno;
+    }
+  }
+#endif
+  yypParser->yytos->stateno = yyact;
+  yypParser->yytos->major = (YYCODETYPE)yymajor;
+  memcpy(&yypParser->yytos->minor, pValue, nValue);
+  yyShiftHook(yypParser);
+  return yyact;
+}
+
+/*
+** Return the text of rule number iRule, or NULL if there is no such rule.
+** The text is only compiled in when NDEBUG is undefined.  Otherwise every
+** rule's text is empty.
+*/
+const char *ParseRuleName(int iRule){
+  if( iRule<0 || iRule>=YYNRULE ) return 0;
+#ifndef NDEBUG
+  return yyRuleName[iRule];
+#else
+  return "";
+#endif
+}
+
 /*
 ** Return the fallback token corresponding to canonical token iToken, or
 ** 0 if iToken has no fallback.